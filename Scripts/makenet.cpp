@@ -0,0 +1,62 @@
+// Writes a network with the header the engine validates in front of its weights.
+// Usage: makenet <raw or headered network> <output>
+// The Makefile builds it for the host and runs it on EVALFILE, so the embedded network always has a header
+#include "../source/nnue.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+using namespace NNUE;
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: makenet <network> <output>" << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) {
+        std::cerr << "Failed to open file " << argv[1] << std::endl;
+        return 1;
+    }
+
+    const std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    const unsigned char* weights = data.data();
+    size_t size = data.size();
+
+    // A network that already has a header is only written again if it fits this build
+    if (size >= sizeof(NetworkHeader) && std::memcmp(weights, NETWORK_MAGIC, sizeof(NETWORK_MAGIC)) == 0) {
+        NetworkHeader header;
+        std::memcpy(&header, weights, sizeof(header));
+
+        weights += sizeof(NetworkHeader);
+        size -= sizeof(NetworkHeader);
+
+        if (header.version != NETWORK_VERSION || header.archHash != ARCH_HASH
+            || size != NETWORK_BYTES || Checksum(weights, size) != header.checksum) {
+            std::cerr << "Network " << argv[1] << " has a header that does not match this build" << std::endl;
+            return 1;
+        }
+    }
+
+    if (size != NETWORK_BYTES) {
+        std::cerr << "Network " << argv[1] << " has " << size << " bytes, expected " << NETWORK_BYTES << std::endl;
+        return 1;
+    }
+
+    const NetworkHeader header = MakeNetworkHeader(weights);
+
+    std::ofstream out(argv[2], std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(weights), size);
+
+    if (!out) {
+        std::cerr << "Failed to write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include "accumulator.h"
 #include "types.h"
 #include "bitboard.h"
+#include "simd.h"
+#include "board.h"
 
 namespace ACC {
 
@@ -17,70 +19,248 @@ int CalculateIndex(bool perspective, bool side, int pieceType, int square, bool
     return side * 64 * 6 + pieceType * 64 + square;
 }
 
-// All friendly, for quiets
-void AccumulatorPair::addSub(bool stm, int add, int addPT, int sub, int subPT, BucketPair bp) {
-    int addW = CalculateIndex(White, stm, addPT, add, mirroredWhite);
-    int addB = CalculateIndex(Black, stm, addPT, add, mirroredBlack);
+static_assert(NNUE::HL_SIZE % TILE_SIZE == 0, "HL size must be divisible by the tile size used for accumulator updates");
 
-    int subW = CalculateIndex(White, stm, subPT, sub, mirroredWhite);
-    int subB = CalculateIndex(Black, stm, subPT, sub, mirroredBlack);
+static const int16_t* WeightRow(int bucket, int index) {
+    return &NNUE::net->accumulator_weights[bucket][index * NNUE::HL_SIZE];
+}
+
+// Applies every added and removed feature row on top of the source accumulator one tile at a time,
+// keeping the running sums in registers so each weight row is streamed only once
+template <size_t ADDS, size_t SUBS>
+static void ApplyUpdates(const Accumulator& src, Accumulator& dst, int bucket,
+    const std::array<int, ADDS>& adds, const std::array<int, SUBS>& subs) {
+
+    std::array<const int16_t*, ADDS> addRows;
+    std::array<const int16_t*, SUBS> subRows;
+
+    for (size_t i = 0; i < ADDS; i++) addRows[i] = WeightRow(bucket, adds[i]);
+    for (size_t i = 0; i < SUBS; i++) subRows[i] = WeightRow(bucket, subs[i]);
+
+    for (size_t tile = 0; tile < NNUE::HL_SIZE; tile += TILE_SIZE) {
+        nativeVector regs[TILE_REGS];
+
+        for (size_t r = 0; r < TILE_REGS; r++)
+            regs[r] = load_epi16(reinterpret_cast<const nativeVector*>(&src[tile + r * VECTOR_SIZE]));
+
+        for (size_t i = 0; i < ADDS; i++) {
+            for (size_t r = 0; r < TILE_REGS; r++)
+                regs[r] = add_epi16(regs[r], load_epi16(reinterpret_cast<const nativeVector*>(&addRows[i][tile + r * VECTOR_SIZE])));
+        }
+
+        for (size_t i = 0; i < SUBS; i++) {
+            for (size_t r = 0; r < TILE_REGS; r++)
+                regs[r] = sub_epi16(regs[r], load_epi16(reinterpret_cast<const nativeVector*>(&subRows[i][tile + r * VECTOR_SIZE])));
+        }
+
+        for (size_t r = 0; r < TILE_REGS; r++)
+            store_epi16(reinterpret_cast<nativeVector*>(&dst[tile + r * VECTOR_SIZE]), regs[r]);
+    }
+}
+
+// Same as above with a runtime number of features, used by refreshes
+static void ApplyFeatures(Accumulator& acc, int bucket, const int* adds, size_t addCount, const int* subs, size_t subCount) {
+    for (size_t tile = 0; tile < NNUE::HL_SIZE; tile += TILE_SIZE) {
+        nativeVector regs[TILE_REGS];
+
+        for (size_t r = 0; r < TILE_REGS; r++)
+            regs[r] = load_epi16(reinterpret_cast<const nativeVector*>(&acc[tile + r * VECTOR_SIZE]));
+
+        for (size_t i = 0; i < addCount; i++) {
+            const int16_t* row = WeightRow(bucket, adds[i]);
+            for (size_t r = 0; r < TILE_REGS; r++)
+                regs[r] = add_epi16(regs[r], load_epi16(reinterpret_cast<const nativeVector*>(&row[tile + r * VECTOR_SIZE])));
+        }
+
+        for (size_t i = 0; i < subCount; i++) {
+            const int16_t* row = WeightRow(bucket, subs[i]);
+            for (size_t r = 0; r < TILE_REGS; r++)
+                regs[r] = sub_epi16(regs[r], load_epi16(reinterpret_cast<const nativeVector*>(&row[tile + r * VECTOR_SIZE])));
+        }
+
+        for (size_t r = 0; r < TILE_REGS; r++)
+            store_epi16(reinterpret_cast<nativeVector*>(&acc[tile + r * VECTOR_SIZE]), regs[r]);
+    }
+}
+
+void FinnyTable::Reset() {
+    for (FinnyEntry& entry : entries) {
+        entry.acc = NNUE::net->accumulator_biases;
+        entry.pieces = {};
+        entry.colors = {};
+    }
+}
+
+void FinnyTable::Refresh(Accumulator& acc, const Board& board, bool perspective, int bucket, bool mirrored) {
+    FinnyEntry& entry = entries[(perspective * NNUE::INPUT_BUCKETS + bucket) * 2 + mirrored];
+
+    // Sized for a full board, SetByFen does not limit the number of pieces
+    std::array<int, 64> adds;
+    std::array<int, 64> subs;
+    size_t addCount = 0;
+    size_t subCount = 0;
+
+    for (bool side : {White, Black}) {
+        for (int pieceType = Pawn; pieceType <= King; pieceType++) {
+            Bitboard current = board.pieces[pieceType] & board.colors[side];
+            Bitboard cached = entry.pieces[pieceType] & entry.colors[side];
+
+            Bitboard added = current & ~cached;
+            Bitboard removed = cached & ~current;
+
+            while (added) {
+                int square = added.getLS1BIndex();
+                adds[addCount++] = CalculateIndex(perspective, side, pieceType, square, mirrored);
+                added.PopBit(square);
+            }
+
+            while (removed) {
+                int square = removed.getLS1BIndex();
+                subs[subCount++] = CalculateIndex(perspective, side, pieceType, square, mirrored);
+                removed.PopBit(square);
+            }
+        }
+    }
 
-    for (int i = 0; i < NNUE::HL_SIZE; i++) {
-        white[i] += NNUE::net.accumulator_weights[bp.white][addW * NNUE::HL_SIZE + i]
-        - NNUE::net.accumulator_weights[bp.white][subW * NNUE::HL_SIZE + i];
-        
-        black[i] += NNUE::net.accumulator_weights[bp.black][addB * NNUE::HL_SIZE + i]
-        - NNUE::net.accumulator_weights[bp.black][subB * NNUE::HL_SIZE + i];
+    ApplyFeatures(entry.acc, bucket, adds.data(), addCount, subs.data(), subCount);
+
+    entry.pieces = board.pieces;
+    entry.colors = board.colors;
+
+    acc = entry.acc;
+}
+
+bool IsMirrored(int kingSquare) {
+    return kingSquare % 8 > 3;
+}
+
+void AccumulatorPair::Refresh(const Board& board) {
+    const auto bucketPair = board.GetBuckets();
+
+    mirroredWhite = IsMirrored((board.pieces[King] & board.colors[White]).getLS1BIndex());
+    mirroredBlack = IsMirrored((board.pieces[King] & board.colors[Black]).getLS1BIndex());
+
+    Refresh(board, White, bucketPair.white);
+    Refresh(board, Black, bucketPair.black);
+}
+
+void AccumulatorPair::Refresh(const Board& board, bool perspective, int bucket) {
+    std::array<int, 64> adds;
+    size_t addCount = 0;
+
+    for (bool side : {White, Black}) {
+        Bitboard sidePieces = board.colors[side];
+
+        while (sidePieces) {
+            int square = sidePieces.getLS1BIndex();
+            adds[addCount++] = CalculateIndex(perspective, side, board.mailbox[square], square, Mirrored(perspective));
+            sidePieces.PopBit(square);
+        }
     }
+
+    Accumulator& acc = Get(perspective);
+    acc = NNUE::net->accumulator_biases;
+
+    ApplyFeatures(acc, bucket, adds.data(), addCount, nullptr, 0);
 }
 
-// Captures
-void AccumulatorPair::addSubSub(bool stm, int add, int addPT, int sub1, int subPT1, int sub2, int subPT2, BucketPair bp) {
-    int addW = CalculateIndex(White, stm, addPT, add, mirroredWhite);
-    int addB = CalculateIndex(Black, stm, addPT, add, mirroredBlack);
+template <size_t ADDS, size_t SUBS>
+static void UpdatePerspective(const Accumulator& src, Accumulator& dst, bool perspective, bool mirrored,
+    int bucket, const DirtyPieces& dirty) {
 
-    int subW1 = CalculateIndex(White, stm, subPT1, sub1, mirroredWhite);
-    int subB1 = CalculateIndex(Black, stm, subPT1, sub1, mirroredBlack);
+    std::array<int, ADDS> adds;
+    std::array<int, SUBS> subs;
 
-    int subW2 = CalculateIndex(White, !stm, subPT2, sub2, mirroredWhite);
-    int subB2 = CalculateIndex(Black, !stm, subPT2, sub2, mirroredBlack);
+    for (size_t i = 0; i < ADDS; i++)
+        adds[i] = CalculateIndex(perspective, dirty.adds[i].color, dirty.adds[i].pieceType, dirty.adds[i].square, mirrored);
 
-    for (int i = 0; i < NNUE::HL_SIZE; i++) {
-        white[i] += NNUE::net.accumulator_weights[bp.white][addW * NNUE::HL_SIZE + i]
-        - NNUE::net.accumulator_weights[bp.white][subW1 * NNUE::HL_SIZE + i]
-        - NNUE::net.accumulator_weights[bp.white][subW2 * NNUE::HL_SIZE + i];
+    for (size_t i = 0; i < SUBS; i++)
+        subs[i] = CalculateIndex(perspective, dirty.subs[i].color, dirty.subs[i].pieceType, dirty.subs[i].square, mirrored);
 
-        black[i] += NNUE::net.accumulator_weights[bp.black][addB * NNUE::HL_SIZE + i]
-        - NNUE::net.accumulator_weights[bp.black][subB1 * NNUE::HL_SIZE + i]
-        - NNUE::net.accumulator_weights[bp.black][subB2 * NNUE::HL_SIZE + i];
+    ApplyUpdates<ADDS, SUBS>(src, dst, bucket, adds, subs);
+}
+
+void AccumulatorPair::Update(const AccumulatorPair& prev, const DirtyPieces& dirty, bool perspective, int bucket) {
+    const Accumulator& src = prev.Get(perspective);
+    Accumulator& dst = Get(perspective);
+
+    // Quiets, captures and castling respectively. Null moves change no features
+    if (dirty.addCount == 1 && dirty.subCount == 1) {
+        UpdatePerspective<1, 1>(src, dst, perspective, Mirrored(perspective), bucket, dirty);
+    } else if (dirty.addCount == 1 && dirty.subCount == 2) {
+        UpdatePerspective<1, 2>(src, dst, perspective, Mirrored(perspective), bucket, dirty);
+    } else if (dirty.addCount == 2 && dirty.subCount == 2) {
+        UpdatePerspective<2, 2>(src, dst, perspective, Mirrored(perspective), bucket, dirty);
+    } else {
+        dst = src;
     }
 }
 
-// Castling
-void AccumulatorPair::addAddSubSub(bool stm, int add1, int addPT1, int add2, int addPT2, int sub1, int subPT1, int sub2, int subPT2, BucketPair bp) {
-    int addW1 = CalculateIndex(White, stm, addPT1, add1, mirroredWhite);
-    int addB1 = CalculateIndex(Black, stm, addPT1, add1, mirroredBlack);
+void AccumulatorStack::Reset(const Board& board) {
+    AccumulatorEntry& root = stack[0];
+
+    finny.Reset();
+
+    root.accPair.Refresh(board);
+    root.buckets = board.GetBuckets();
+    root.dirty = DirtyPieces();
+    root.refresh = {false, false};
+    root.computed = {true, true};
+}
+
+void AccumulatorStack::Push(int ply, const Board& board) {
+    AccumulatorEntry& entry = stack[ply];
+    const AccumulatorEntry& parent = stack[ply - 1];
 
-    int addW2 = CalculateIndex(White, stm, addPT2, add2, mirroredWhite);
-    int addB2 = CalculateIndex(Black, stm, addPT2, add2, mirroredBlack);
+    entry.dirty = board.dirty;
+    entry.buckets = board.GetBuckets();
+    entry.accPair.mirroredWhite = IsMirrored((board.pieces[King] & board.colors[White]).getLS1BIndex());
+    entry.accPair.mirroredBlack = IsMirrored((board.pieces[King] & board.colors[Black]).getLS1BIndex());
 
-    int subW1 = CalculateIndex(White, stm, subPT1, sub1, mirroredWhite);
-    int subB1 = CalculateIndex(Black, stm, subPT1, sub1, mirroredBlack);
+    // Only the perspective of a king that crossed a boundary has to be refreshed
+    entry.refresh[White] = entry.buckets.white != parent.buckets.white
+                        || entry.accPair.mirroredWhite != parent.accPair.mirroredWhite;
+    entry.refresh[Black] = entry.buckets.black != parent.buckets.black
+                        || entry.accPair.mirroredBlack != parent.accPair.mirroredBlack;
 
-    int subW2 = CalculateIndex(White, stm, subPT2, sub2, mirroredWhite);
-    int subB2 = CalculateIndex(Black, stm, subPT2, sub2, mirroredBlack);
+    entry.computed = {false, false};
+}
+
+const AccumulatorPair& AccumulatorStack::Get(int ply, const Board& board) {
+    AccumulatorEntry& entry = stack[ply];
+
+    for (bool perspective : {White, Black}) {
+        if (entry.computed[perspective])
+            continue;
+
+        const int bucket = perspective == White ? entry.buckets.white : entry.buckets.black;
 
-    for (int i = 0; i < NNUE::HL_SIZE; i++) {
-        white[i] += NNUE::net.accumulator_weights[bp.white][addW1 * NNUE::HL_SIZE + i]
-        + NNUE::net.accumulator_weights[bp.white][addW2 * NNUE::HL_SIZE + i]
-        - NNUE::net.accumulator_weights[bp.white][subW1 * NNUE::HL_SIZE + i]
-        - NNUE::net.accumulator_weights[bp.white][subW2 * NNUE::HL_SIZE + i];
+        // Walk back to the closest computed ancestor. If this perspective's king crossed a boundary on the way,
+        // the parent accumulators are useless and the position is rebuilt through the refresh cache instead
+        int base = ply;
+        bool refresh = false;
 
-        black[i] += NNUE::net.accumulator_weights[bp.black][addB1 * NNUE::HL_SIZE + i]
-        + NNUE::net.accumulator_weights[bp.black][addB2 * NNUE::HL_SIZE + i]
-        - NNUE::net.accumulator_weights[bp.black][subB1 * NNUE::HL_SIZE + i]
-        - NNUE::net.accumulator_weights[bp.black][subB2 * NNUE::HL_SIZE + i];
+        while (!stack[base].computed[perspective]) {
+            if (stack[base].refresh[perspective]) {
+                refresh = true;
+                break;
+            }
+            base--;
+        }
+
+        if (refresh) {
+            finny.Refresh(entry.accPair.Get(perspective), board, perspective, bucket, entry.accPair.Mirrored(perspective));
+            entry.computed[perspective] = true;
+            continue;
+        }
+
+        for (int i = base + 1; i <= ply; i++) {
+            stack[i].accPair.Update(stack[i - 1].accPair, stack[i].dirty, perspective, bucket);
+            stack[i].computed[perspective] = true;
+        }
     }
+
+    return entry.accPair;
 }
 
 }
@@ -1,28 +1,112 @@
 #pragma once
+#include <vector>
 #include "nnue.h"
+#include "bitboard.h"
+#include "types.h"
 
 namespace ACC {
 
 struct BucketPair {
     int white;
     int black;
+
+    bool operator==(const BucketPair& other) const = default;
 };
 
 using Accumulator = std::array<int16_t, NNUE::HL_SIZE>;
 
+struct DirtyPiece {
+    int pieceType;
+    int square;
+    bool color;
+};
+
+// Feature changes caused by a single move, applied lazily to the accumulators
+struct DirtyPieces {
+    std::array<DirtyPiece, 2> adds;
+    std::array<DirtyPiece, 2> subs;
+    int addCount = 0;
+    int subCount = 0;
+
+    void Add(int pieceType, int square, bool color) {
+        adds[addCount++] = {pieceType, square, color};
+    }
+
+    void Sub(int pieceType, int square, bool color) {
+        subs[subCount++] = {pieceType, square, color};
+    }
+};
+
 struct AccumulatorPair {
-    alignas(32) Accumulator white;
-    alignas(32) Accumulator black;
-    
+    alignas(ALIGNMENT) Accumulator white;
+    alignas(ALIGNMENT) Accumulator black;
+
     bool mirroredWhite = false;
     bool mirroredBlack = false;
 
-    // yoinked from Quinniboi - Prelude
-    void addSub(bool stm, int add, int addPT, int sub, int subPT, BucketPair bp);
-    void addSubSub(bool stm, int add, int addPT, int sub1, int subPT1, int sub2, int subPT2, BucketPair bp);
-    void addAddSubSub(bool stm, int add1, int addPT1, int add2, int addPT2, int sub1, int subPT1, int sub2, int subPT2, BucketPair bp);
+    Accumulator& Get(bool perspective) {
+        return perspective == White ? white : black;
+    }
+
+    const Accumulator& Get(bool perspective) const {
+        return perspective == White ? white : black;
+    }
+
+    bool Mirrored(bool perspective) const {
+        return perspective == White ? mirroredWhite : mirroredBlack;
+    }
+
+    void Refresh(const Board& board);
+    void Refresh(const Board& board, bool perspective, int bucket);
+
+    // Applies the dirty pieces of a move on top of the parent accumulator of one perspective
+    void Update(const AccumulatorPair& prev, const DirtyPieces& dirty, bool perspective, int bucket);
+};
+
+struct AccumulatorEntry {
+    AccumulatorPair accPair;
+    DirtyPieces dirty;
+    BucketPair buckets;
+
+    // Indexed by perspective, set when that side's king crossed a bucket or mirroring boundary
+    std::array<bool, 2> refresh{};
+    std::array<bool, 2> computed{};
+};
+
+// Last accumulator built for a king bucket and mirroring state along with the pieces it was built from,
+// so a refresh only has to apply the pieces that changed since
+struct FinnyEntry {
+    alignas(ALIGNMENT) Accumulator acc;
+    std::array<Bitboard, 6> pieces;
+    std::array<Bitboard, 2> colors;
+};
+
+class FinnyTable {
+private:
+    // Indexed by [perspective][bucket][mirrored]
+    std::vector<FinnyEntry> entries;
+public:
+    FinnyTable() : entries(2 * NNUE::INPUT_BUCKETS * 2) {}
+
+    void Reset();
+    void Refresh(Accumulator& acc, const Board& board, bool perspective, int bucket, bool mirrored);
+};
+
+// Per-thread accumulators indexed by ply, materialized only when a node is evaluated
+class AccumulatorStack {
+private:
+    std::vector<AccumulatorEntry> stack;
+    FinnyTable finny;
+public:
+    AccumulatorStack(int size) : stack(size) {}
+
+    void Reset(const Board& board);
+    void Push(int ply, const Board& board);
+    const AccumulatorPair& Get(int ply, const Board& board);
 };
 
 int CalculateIndex(bool perspective, bool side, int pieceType, int square, bool mirrored);
 
+bool IsMirrored(int kingSquare);
+
 }
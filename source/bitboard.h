@@ -6,10 +6,10 @@ struct Bitboard {
 private:
 	U64 m_board;
 public:
-	Bitboard()
+	constexpr Bitboard()
 		: m_board(0ULL) {}
 
-	Bitboard(const U64& board)
+	constexpr Bitboard(const U64& board)
 		: m_board(board) {}
 
 	bool IsSet(int square) const;
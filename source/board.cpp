@@ -30,17 +30,13 @@ void Board::Reset() {
 	pieces = std::array<Bitboard, 6>();
 	colors = std::array<Bitboard, 2>();
 
-	accPair = ACC::AccumulatorPair();
+	dirty = ACC::DirtyPieces();
 
 	pieceThreats = std::array<Bitboard, 6>();
 	colorThreats = std::array<Bitboard, 2>();
 
-    moveList = std::array<Move, MAX_MOVES>();
-
 	positionIndex = 0;
 
-    currentMoveIndex = 0;
-
     hashKey = 0ULL;
     pawnKey = 0ULL;
     nonPawnKey = 0ULL;
@@ -104,19 +100,6 @@ void Board::SetByFen(std::string_view fen) {
     pinned = {CalcPinned(White), CalcPinned(Black)};
     CalcCheckers();
 	MOVEGEN::GenThreatMaps(*this);
-	MOVEGEN::GenerateMoves<All>(*this, true);
-
-    int whiteKingFile = (pieces[King] & colors[White]).getLS1BIndex() % 8;
-    int blackKingFile = (pieces[King] & colors[Black]).getLS1BIndex() % 8;
-
-    if (whiteKingFile > 3) {
-        accPair.mirroredWhite = true;
-    }
-    if (blackKingFile > 3) {
-        accPair.mirroredBlack = true;
-    }
-
-    ResetAccPair();
 }
 
 std::string Board::GetFen() {
@@ -251,30 +234,18 @@ void Board::PrintBoard() {
 }
 
 void Board::PrintNNUE() {
-	std::cout << "Final eval: " << NNUE::net.Evaluate(*this) << std::endl;
-}
-
-void Board::AddMove(Move move) {
-    moveList[currentMoveIndex] = move;
-    currentMoveIndex++;
-}
-
-void Board::ResetMoves() {
-    currentMoveIndex = 0;
+	std::cout << "Final eval: " << NNUE::net->Evaluate(*this) << std::endl;
 }
 
 void Board::ListMoves() {
-	int moveCount = 1;
-	for (int i = 0; i < currentMoveIndex; i++) {
-        if (!IsLegal(moveList[i])) continue;
-
-		Board copy = *this;
-		copy.MakeMove(moveList[i]);
-
+    MoveList moveList;
+    MOVEGEN::GenerateMoves<All>(*this, moveList);
 
+	int moveCount = 1;
+	for (Move move : moveList) {
 		std::cout << moveCount << ". ";
-		moveList[i].PrintMove();
-		std::cout << "( " << moveTypes[moveList[i].GetFlags()] << " )";
+		move.PrintMove();
+		std::cout << "( " << moveTypes[move.GetFlags()] << " )";
 		std::cout << std::endl;
 		moveCount++;
 	}
@@ -371,6 +342,8 @@ void Board::Promote(int square, int pieceType, int color, bool isCapture) {
 }
 
 void Board::MakeMove(Move move) {
+    dirty = ACC::DirtyPieces();
+
 	// Null Move
     if (!move) {
 		int newEpTarget = noEPTarget;
@@ -397,29 +370,6 @@ void Board::MakeMove(Move move) {
 
 	int endPiece = attackerPiece;
 
-    bool fullRecalc = false;
-    const auto bucketPair = GetBuckets();
-
-    if (attackerPiece == King) {
-        const int toFile = move.MoveTo() % 8;
-
-        if (attackerColor == White) {
-            if ((toFile > 3) != accPair.mirroredWhite) {
-                accPair.mirroredWhite = !accPair.mirroredWhite;
-                fullRecalc = true;
-            }
-        } else {
-            if ((toFile > 3) != accPair.mirroredBlack) {
-                accPair.mirroredBlack = !accPair.mirroredBlack;
-                fullRecalc = true;
-            }
-        }
-
-        if (NNUE::kingBuckets[attackerColor][move.MoveFrom()] != NNUE::kingBuckets[attackerColor][move.MoveTo()]) {
-            fullRecalc = true;
-        }
-    }
-
 	// Removing attacker piece from old position
 	RemovePiece(attackerPiece, move.MoveFrom(), attackerColor);
 
@@ -432,17 +382,15 @@ void Board::MakeMove(Move move) {
 		}
 	}
 
-    if (!fullRecalc) {
-        if (move.IsCapture()) {
-            if (move.GetFlags() != epCapture) {
-                accPair.addSubSub(sideToMove, move.MoveTo(), endPiece, move.MoveFrom(), attackerPiece, move.MoveTo(), targetPiece, bucketPair);
-            } else {
-                accPair.addSubSub(sideToMove, enPassantTarget, endPiece, move.MoveFrom(), attackerPiece, move.MoveTo() - direction, Pawn, bucketPair);
-            }
-        } else {
-            if (move.GetFlags() != kingCastle && move.GetFlags() != queenCastle) {
-                accPair.addSub(sideToMove, move.MoveTo(), endPiece, move.MoveFrom(), attackerPiece, bucketPair);
-            }
+    // Recording the feature changes, the accumulators are updated lazily by the search
+    if (move.GetFlags() != kingCastle && move.GetFlags() != queenCastle) {
+        dirty.Add(endPiece, move.MoveTo(), attackerColor);
+        dirty.Sub(attackerPiece, move.MoveFrom(), attackerColor);
+
+        if (move.GetFlags() == epCapture) {
+            dirty.Sub(Pawn, move.MoveTo() - direction, !attackerColor);
+        } else if (move.IsCapture()) {
+            dirty.Sub(targetPiece, move.MoveTo(), !attackerColor);
         }
     }
 
@@ -478,9 +426,10 @@ void Board::MakeMove(Move move) {
 
 			SetPiece(attackerPiece, move.MoveTo(), attackerColor);
 
-            if (!fullRecalc) {
-                accPair.addAddSubSub(sideToMove, move.MoveTo(), King, rookSquare - 2, Rook, move.MoveFrom(), King, rookSquare, Rook, bucketPair);
-            }
+            dirty.Add(King, move.MoveTo(), attackerColor);
+            dirty.Add(Rook, rookSquare - 2, attackerColor);
+            dirty.Sub(King, move.MoveFrom(), attackerColor);
+            dirty.Sub(Rook, rookSquare, attackerColor);
 
 			break;
 		}
@@ -496,9 +445,10 @@ void Board::MakeMove(Move move) {
 
 			SetPiece(attackerPiece, move.MoveTo(), attackerColor);
 
-            if (!fullRecalc) {
-                accPair.addAddSubSub(sideToMove, move.MoveTo(), King, rookSquare + 3, Rook, move.MoveFrom(), King, rookSquare, Rook, bucketPair);
-            }
+            dirty.Add(King, move.MoveTo(), attackerColor);
+            dirty.Add(Rook, rookSquare + 3, attackerColor);
+            dirty.Sub(King, move.MoveFrom(), attackerColor);
+            dirty.Sub(Rook, rookSquare, attackerColor);
 
             break;
 		}
@@ -506,10 +456,6 @@ void Board::MakeMove(Move move) {
 		break;
 	}
 
-    if (fullRecalc) {
-        ResetAccPair();
-    }
-
 	// Removing the right to castle on king and rook movement
 	UpdateCastlingRights(*this, move.MoveFrom(), attackerPiece, attackerColor);
 
@@ -549,60 +495,110 @@ void Board::MakeMove(Move move) {
     positionIndex++;
 }
 
-bool Board::InPossibleZug() {
-    Bitboard toCheck;
+void Board::MakeMove(Move move, BoardState& state) {
+    state.pinned = pinned;
+    state.checkers = checkers;
+    state.pieceThreats = pieceThreats;
+    state.colorThreats = colorThreats;
+    state.checkZones = checkZones;
 
-    // For all pieces other than pawns and king
-    for (int piece = Knight; piece <= Queen; piece++) {
-        toCheck |= (pieces[piece] & colors[sideToMove]);
-    }
+    state.hashKey = hashKey;
+    state.pawnKey = pawnKey;
+    state.nonPawnKey = nonPawnKey;
+    state.majorKey = majorKey;
 
-    return !toCheck;
+    state.castlingRights = castlingRights;
+    state.enPassantTarget = enPassantTarget;
+    state.halfMoves = halfMoves;
+    state.fullMoves = fullMoves;
+
+    state.capturedPiece = GetPieceType(move.MoveTo());
+
+    MakeMove(move);
 }
 
-ACC::BucketPair Board::GetBuckets() {
-    int wKingSq = (pieces[King] & colors[White]).getLS1BIndex();
-    int bKingSq = (pieces[King] & colors[Black]).getLS1BIndex();
+// Piece placement for unmaking moves, the hash keys are restored from the saved state instead
+static void PlacePiece(Board &board, int piece, int square, bool color) {
+    board.pieces[piece].SetBit(square);
+    board.colors[color].SetBit(square);
+    board.occupied.SetBit(square);
 
-    return {NNUE::kingBuckets[White][wKingSq],NNUE::kingBuckets[Black][bKingSq]};
+    board.mailbox[square] = piece;
 }
 
-void Board::ResetAccPair() {
-	Bitboard whitePieces = colors[White];
-	Bitboard blackPieces = colors[Black];
+static void LiftPiece(Board &board, int piece, int square, bool color) {
+    board.pieces[piece].PopBit(square);
+    board.colors[color].PopBit(square);
+    board.occupied.PopBit(square);
 
-	accPair.white = NNUE::net.accumulator_biases;
-	accPair.black = NNUE::net.accumulator_biases;
+    board.mailbox[square] = nullPieceType;
+}
 
-    const auto bucketPair = GetBuckets();
+void Board::UnmakeMove(Move move, const BoardState& state) {
+    sideToMove = !sideToMove;
 
-	while (whitePieces) {
-		int square = whitePieces.getLS1BIndex();
+    if (move) {
+        const bool us = sideToMove;
+        const int from = move.MoveFrom();
+        const int to = move.MoveTo();
 
-		int wInput = ACC::CalculateIndex(White, White, GetPieceType(square), square, accPair.mirroredWhite);
-		int bInput = ACC::CalculateIndex(Black, White, GetPieceType(square), square, accPair.mirroredBlack);
+        if (move.GetFlags() == kingCastle || move.GetFlags() == queenCastle) {
+            const int rookFrom = move.GetFlags() == kingCastle ? (us ? h8 : h1) : (us ? a8 : a1);
+            const int rookTo = move.GetFlags() == kingCastle ? rookFrom - 2 : rookFrom + 3;
 
-		for (int i = 0; i < NNUE::HL_SIZE; i++) {
-			accPair.white[i] += NNUE::net.accumulator_weights[bucketPair.white][wInput * NNUE::HL_SIZE + i];
-			accPair.black[i] += NNUE::net.accumulator_weights[bucketPair.black][bInput * NNUE::HL_SIZE + i];
-		}
+            LiftPiece(*this, King, to, us);
+            PlacePiece(*this, King, from, us);
+            LiftPiece(*this, Rook, rookTo, us);
+            PlacePiece(*this, Rook, rookFrom, us);
+        } else {
+            const int endPiece = GetPieceType(to);
 
-		whitePieces.PopBit(square);
-	}
+            LiftPiece(*this, endPiece, to, us);
+            PlacePiece(*this, move.IsPromo() ? Pawn : endPiece, from, us);
 
-	while (blackPieces) {
-		int square = blackPieces.getLS1BIndex();
+            if (move.GetFlags() == epCapture) {
+                PlacePiece(*this, Pawn, to - (us ? south : north), !us);
+            } else if (move.IsCapture()) {
+                PlacePiece(*this, state.capturedPiece, to, !us);
+            }
+        }
 
-		int wInput = ACC::CalculateIndex(White, Black, GetPieceType(square), square, accPair.mirroredWhite);
-		int bInput = ACC::CalculateIndex(Black, Black, GetPieceType(square), square, accPair.mirroredBlack);
+        positionIndex--;
+    }
 
-		for (int i = 0; i < NNUE::HL_SIZE; i++) {
-			accPair.white[i] += NNUE::net.accumulator_weights[bucketPair.white][wInput * NNUE::HL_SIZE + i];
-			accPair.black[i] += NNUE::net.accumulator_weights[bucketPair.black][bInput * NNUE::HL_SIZE + i];
-		}
+    pinned = state.pinned;
+    checkers = state.checkers;
+    pieceThreats = state.pieceThreats;
+    colorThreats = state.colorThreats;
+    checkZones = state.checkZones;
 
-		blackPieces.PopBit(square);
-	}
+    hashKey = state.hashKey;
+    pawnKey = state.pawnKey;
+    nonPawnKey = state.nonPawnKey;
+    majorKey = state.majorKey;
+
+    castlingRights = state.castlingRights;
+    enPassantTarget = state.enPassantTarget;
+    halfMoves = state.halfMoves;
+    fullMoves = state.fullMoves;
+}
+
+bool Board::InPossibleZug() {
+    Bitboard toCheck;
+
+    // For all pieces other than pawns and king
+    for (int piece = Knight; piece <= Queen; piece++) {
+        toCheck |= (pieces[piece] & colors[sideToMove]);
+    }
+
+    return !toCheck;
+}
+
+ACC::BucketPair Board::GetBuckets() const {
+    int wKingSq = (pieces[King] & colors[White]).getLS1BIndex();
+    int bKingSq = (pieces[King] & colors[Black]).getLS1BIndex();
+
+    return {NNUE::kingBuckets[White][wKingSq],NNUE::kingBuckets[Black][bKingSq]};
 }
 
 Bitboard Board::AttacksTo(int square, Bitboard occupancy) {
@@ -634,65 +630,6 @@ Bitboard Board::AttacksTo(int square, Bitboard occupancy) {
     return attacks;
 }
 
-static Bitboard rayBetween(int sq1, int sq2) {
-    if (sq1 == sq2) return 0ULL;
-
-    int f1 = sq1 % 8, r1 = sq1 / 8;
-    int f2 = sq2 % 8, r2 = sq2 / 8;
-
-    int df = (f2 > f1) - (f2 < f1);
-    int dr = (r2 > r1) - (r2 < r1);
-
-    // must be same rank, file, or diagonal
-    if (df != 0 && dr != 0 && std::abs(f2 - f1) != std::abs(r2 - r1))
-        return 0ULL;
-
-    Bitboard ray = 0ULL;
-
-    int f = f1 + df;
-    int r = r1 + dr;
-
-    while (f != f2 || r != r2) {
-        ray |= 1ULL << (r * 8 + f);
-        f += df;
-        r += dr;
-    }
-
-    ray &= ~((1ULL << sq1) | (1ULL << sq2));
-
-    return ray;
-}
-
-// Returns the full ray from `from` in the direction of `to`, to the edge of the board
-static Bitboard fullRay(int from, int to) {
-    int df = (to % 8) - (from % 8);
-    int dr = (to / 8) - (from / 8);
-
-    if (df != 0) df /= std::abs(df);
-    if (dr != 0) dr /= std::abs(dr);
-
-    Bitboard ray = 0ULL;
-
-    int f = from % 8 + df;
-    int r = from / 8 + dr;
-    while (f >= 0 && f < 8 && r >= 0 && r < 8) {
-        ray |= 1ULL << (r * 8 + f);
-        f += df;
-        r += dr;
-    }
-
-    f = from % 8 - df;
-    r = from / 8 - dr;
-    while (f >= 0 && f < 8 && r >= 0 && r < 8) {
-        ray |= 1ULL << (r * 8 + f);
-        f -= df;
-        r -= dr;
-    }
-
-    ray |= 1ULL << from;
-    return ray;
-}
-
 bool Board::IsSquareThreatened(bool side, int square) {
 	return colorThreats[!side].IsSet(square);
 }
@@ -716,7 +653,7 @@ Bitboard Board::CalcPinned(bool color) {
     while (potentialAttackers) {
         int attackerSquare = potentialAttackers.getLS1BIndex();
 
-        Bitboard isPinned = colors[color] & rayBetween(attackerSquare, kingSquare);
+        Bitboard isPinned = colors[color] & MOVEGEN::betweenSquares[attackerSquare][kingSquare];
 
         if (isPinned.PopCount() == 1)
             pinned |= isPinned;
@@ -727,6 +664,28 @@ Bitboard Board::CalcPinned(bool color) {
     return pinned;
 }
 
+// Checked with the resulting occupancy, since the captured pawn may also have been shielding the king
+// along a rank or diagonal, or may itself have been the checker
+bool Board::IsEnPassantLegal(int from, int to) {
+    int us = sideToMove;
+    int them = !us;
+
+    int kingSquare = (pieces[King] & colors[us]).getLS1BIndex();
+    int epCapturedSquare = to + (us == White ? -8 : 8);
+
+    Bitboard occAfterEP = occupied ^ Bitboard::GetSquare(from) ^ Bitboard::GetSquare(to)
+                            ^ Bitboard::GetSquare(epCapturedSquare);
+
+    Bitboard theirQueens = pieces[Queen] & colors[them];
+
+    Bitboard leaperCheckers = checkers & (pieces[Knight] | pieces[Pawn]) & ~Bitboard::GetSquare(epCapturedSquare);
+
+    return !leaperCheckers
+        && (MOVEGEN::getBishopAttack(kingSquare, occAfterEP) & (theirQueens | (pieces[Bishop] & colors[them]))).PopCount() < 1
+        && (MOVEGEN::getRookAttack(kingSquare, occAfterEP) & (theirQueens | (pieces[Rook] & colors[them]))).PopCount() < 1;
+}
+
+// The move generator only emits legal moves, this is for moves from elsewhere such as the TT or killers
 bool Board::IsLegal(Move &move) {
     assert(move != 0);
 
@@ -742,14 +701,7 @@ bool Board::IsLegal(Move &move) {
     int moveType = move.GetFlags();
 
     if (moveType == epCapture) {
-        int epCapturedSquare = to + (us == White ? -8 : 8);
-        Bitboard occAfterEP = occupied ^ Bitboard::GetSquare(from) ^ Bitboard::GetSquare(to)
-                                ^ Bitboard::GetSquare(epCapturedSquare);
-
-        Bitboard theirQueens = pieces[Queen] & colors[them];
-
-        return (MOVEGEN::getBishopAttack(kingSquare, occAfterEP) & (theirQueens | (pieces[Bishop] & colors[them]))).PopCount() < 1
-            && (MOVEGEN::getRookAttack(kingSquare, occAfterEP) & (theirQueens | (pieces[Rook] & colors[them]))).PopCount() < 1;
+        return IsEnPassantLegal(from, to);
     }
 
     int movingPiece = GetPieceType(from);
@@ -767,7 +719,7 @@ bool Board::IsLegal(Move &move) {
         return false;
     }
 
-    if (pinned[us].IsSet(from) && !fullRay(kingSquare, from).IsSet(to))
+    if (pinned[us].IsSet(from) && !MOVEGEN::lineSquares[kingSquare][from].IsSet(to))
         return false;
 
     if (checkers.PopCount() < 1)
@@ -775,7 +727,7 @@ bool Board::IsLegal(Move &move) {
 
     int checkerSquare = checkers.getLS1BIndex();
 
-    return (rayBetween(kingSquare, checkerSquare) | checkers).IsSet(to);
+    return (MOVEGEN::betweenSquares[kingSquare][checkerSquare] | checkers).IsSet(to);
 }
 
 bool Board::IsPseudoLegal(Move &move) {
@@ -10,6 +10,31 @@ constexpr int noEPTarget = -1;
 
 constexpr int MAX_MOVES = 218;
 
+// Everything MakeMove overwrites that cannot be recovered from the move itself, saved once per ply by the search.
+// The accumulators need no entry here since the search keeps them in its own ply indexed stack
+struct BoardState {
+    std::array<Bitboard, 2> pinned;
+    Bitboard checkers;
+
+    std::array<Bitboard, 6> pieceThreats;
+    std::array<Bitboard, 2> colorThreats;
+
+    std::array<Bitboard, 4> checkZones;
+
+    U64 hashKey;
+    U64 pawnKey;
+    U64 nonPawnKey;
+    U64 majorKey;
+
+    uint8_t castlingRights;
+    int enPassantTarget;
+
+    int halfMoves;
+    int fullMoves;
+
+    int capturedPiece;
+};
+
 class Board {
 public:
 	Board() {
@@ -26,14 +51,12 @@ public:
     std::array<Bitboard, 2> pinned;
     Bitboard checkers;
 
-    ACC::AccumulatorPair accPair;
+    // Features changed by the last move, consumed lazily by the accumulator stack
+    ACC::DirtyPieces dirty;
 
     std::array<Bitboard, 6> pieceThreats;
 	std::array<Bitboard, 2> colorThreats;
 
-    std::array<Move, MAX_MOVES> moveList;
-    int currentMoveIndex = 0;
-
 	bool sideToMove = White;
 
     uint8_t castlingRights = 0;
@@ -58,12 +81,9 @@ public:
 
 	void PrintNNUE();
 
-	void AddMove(Move move);
-	void ResetMoves();
 	void ListMoves();
 
-	ACC::BucketPair GetBuckets();
-	void ResetAccPair();
+	ACC::BucketPair GetBuckets() const;
 
 	int GetPieceType(int square);
 	int GetPieceColor(int square);
@@ -75,6 +95,8 @@ public:
 
 	void Promote(int square, int pieceType, int color, bool isCapture);
 	void MakeMove(Move move);
+	void MakeMove(Move move, BoardState& state);
+	void UnmakeMove(Move move, const BoardState& state);
 
     bool InPossibleZug();
 
@@ -88,6 +110,7 @@ public:
 	void CalcCheckZones();
 	bool GivesDirectCheck(Move &move);
 
+    bool IsEnPassantLegal(int from, int to);
     bool IsLegal(Move &move);
 	bool IsPseudoLegal(Move &move);
 };
\ No newline at end of file
@@ -13,6 +13,10 @@
 #include <csignal>
 #include <cstdlib>
 #include <cerrno>
+#include <array>
+#include <vector>
+#include <cstring>
+#include <cctype>
 
 #include "datagen.h"
 #include "movegen.h"
@@ -27,6 +31,9 @@
 #else
     #include <pthread.h>
     #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
 #endif
 
 static std::filesystem::path MakeTempPath(const std::string& prefix, const std::string& ext) {
@@ -133,7 +140,7 @@ static bool PostJSON(const std::string& url, const std::string& jsonBody, std::s
 static bool UploadFile(const std::string& url,
                        const std::string& filepath,
                        const std::string& username,
-                       int positions) {
+                       uint64_t positions) {
     std::ostringstream cmd;
 
     cmd << "curl -s -X POST "
@@ -152,7 +159,7 @@ static bool UploadFile(const std::string& url,
     return (result == 0);
 }
 
-static std::string BuildStartJSON(const std::string& username, int targetPositions) {
+static std::string BuildStartJSON(const std::string& username, uint64_t targetPositions) {
     std::ostringstream json;
     json << "{"
          << "\"user\":\"" << username << "\","
@@ -215,6 +222,227 @@ static void HeartbeatThread(const std::string& username, int threads,
 // Signal handling globals
 static std::atomic<bool> g_shutdownRequested(false);
 
+// Start positions read from an EPD or FEN file, one per line. The file is mapped instead of read
+// and only the offsets of its lines are kept, so a book of any size costs 8 bytes per position
+// Checks what SetByFen takes on trust: the board layout, one king per side, at most 16 pieces and 8 pawns
+// per side, no pawns on the back ranks, castling rights backed by a king and rook at home, and an en passant
+// square on the right rank
+static bool IsValidFen(const std::vector<std::string>& fields) {
+    const std::string& placement = fields[0];
+    std::array<char, 64> squares{};
+
+    int rank = 7, file = 0;
+    for (const char c : placement) {
+        if (c == '/') {
+            if (file != 8 || rank == 0) return false;
+            rank--;
+            file = 0;
+        } else if (c >= '1' && c <= '8') {
+            file += c - '0';
+            if (file > 8) return false;
+        } else if (std::string_view("pnbrqkPNBRQK").find(c) != std::string_view::npos) {
+            if (file > 7) return false;
+            squares[rank * 8 + file++] = c;
+        } else {
+            return false;
+        }
+    }
+
+    if (rank != 0 || file != 8) return false;
+
+    if (std::count(squares.begin(), squares.end(), 'K') != 1 || std::count(squares.begin(), squares.end(), 'k') != 1)
+        return false;
+
+    const auto isWhite = [](char c) { return c && std::isupper(static_cast<unsigned char>(c)); };
+    const auto isBlack = [](char c) { return c && std::islower(static_cast<unsigned char>(c)); };
+
+    if (std::count_if(squares.begin(), squares.end(), isWhite) > 16 || std::count_if(squares.begin(), squares.end(), isBlack) > 16
+        || std::count(squares.begin(), squares.end(), 'P') > 8 || std::count(squares.begin(), squares.end(), 'p') > 8) {
+        return false;
+    }
+
+    for (int square = 0; square < 8; square++) {
+        if (std::tolower(squares[square]) == 'p' || std::tolower(squares[56 + square]) == 'p')
+            return false;
+    }
+
+    const std::string& side = fields[1];
+    if (side != "w" && side != "b") return false;
+
+    const std::string& castling = fields[2];
+    if (castling != "-") {
+        for (const char c : castling) {
+            const bool white = c == 'K' || c == 'Q';
+            const int home = white ? 0 : 56;
+            const int rookSquare = home + (std::tolower(c) == 'k' ? 7 : 0);
+
+            if (std::string_view("KQkq").find(c) == std::string_view::npos
+                || squares[home + 4] != (white ? 'K' : 'k')
+                || squares[rookSquare] != (white ? 'R' : 'r')) {
+                return false;
+            }
+        }
+    }
+
+    const std::string& enPassant = fields[3];
+    if (enPassant != "-") {
+        const char epRank = side == "w" ? '6' : '3';
+        if (enPassant.size() != 2 || enPassant[0] < 'a' || enPassant[0] > 'h' || enPassant[1] != epRank)
+            return false;
+    }
+
+    return true;
+}
+
+class OpeningBook {
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+
+#ifdef _WIN32
+    std::string contents;
+#else
+    void* mapping = nullptr;
+#endif
+
+    std::vector<uint64_t> lineStarts;
+    uint64_t skipped = 0;
+
+public:
+    OpeningBook() {}
+
+    OpeningBook(const OpeningBook&) = delete;
+    OpeningBook& operator=(const OpeningBook&) = delete;
+
+    ~OpeningBook() {
+#ifndef _WIN32
+        if (mapping) munmap(mapping, size);
+#endif
+    }
+
+    bool Open(const std::string& path) {
+#ifdef _WIN32
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        contents = buffer.str();
+
+        data = contents.data();
+        size = contents.size();
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return false;
+        }
+
+        size = info.st_size;
+        mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            return false;
+        }
+
+        data = static_cast<const char*>(mapping);
+#endif
+
+        // Blank lines and # comments are not indexed, neither are lines without a usable position
+        for (size_t pos = 0; pos < size;) {
+            const char* newline = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+            const size_t end = newline ? newline - data : size;
+
+            size_t first = pos;
+            while (first < end && std::isspace(static_cast<unsigned char>(data[first]))) first++;
+
+            if (first < end && data[first] != '#') {
+                if (!ParseFen(first).empty()) {
+                    lineStarts.push_back(first);
+                } else {
+                    skipped++;
+                }
+            }
+
+            pos = end + 1;
+        }
+
+#ifndef _WIN32
+        // Positions are picked out of order from here on
+        madvise(mapping, size, MADV_RANDOM);
+#endif
+
+        return !lineStarts.empty();
+    }
+
+    uint64_t Count() const {
+        return lineStarts.size();
+    }
+
+    // Lines that were not indexed because they hold no valid position
+    uint64_t Skipped() const {
+        return skipped;
+    }
+
+    std::string GetFen(uint64_t index) const {
+        return ParseFen(lineStarts[index % lineStarts.size()]);
+    }
+
+private:
+    // The FEN of the line at start, EPD operations are dropped and missing move counters are filled in.
+    // Empty if the line does not hold a valid position
+    std::string ParseFen(uint64_t start) const {
+
+        size_t end = start;
+        while (end < size && data[end] != '\n' && data[end] != ';') end++;
+
+        std::istringstream line(std::string(data + start, end - start));
+        std::vector<std::string> fields;
+        std::string field;
+
+        while (fields.size() < 6 && line >> field)
+            fields.push_back(field);
+
+        if (fields.size() < 4) return "";
+
+        const auto isNumber = [](const std::string& str) {
+            return std::all_of(str.begin(), str.end(), [](unsigned char c) { return std::isdigit(c); });
+        };
+
+        std::string fen = fields[0] + ' ' + fields[1] + ' ' + fields[2] + ' ' + fields[3];
+
+        if (fields.size() == 6 && isNumber(fields[4]) && isNumber(fields[5])) {
+            fen += ' ' + fields[4] + ' ' + fields[5];
+        } else {
+            fen += " 0 1";
+        }
+
+        if (!IsValidFen(fields)) return "";
+
+        // The side to move must not be able to take the other king
+        Board board;
+        board.SetByFen(fen);
+
+        if (board.colorThreats[board.sideToMove] & board.pieces[King] & board.colors[!board.sideToMove])
+            return "";
+
+        return fen;
+    }
+};
+
+// Set by Run and RunOnline before the workers start
+static DatagenOptions workerOptions;
+static OpeningBook* workerBook = nullptr;
+static int workerCount = 1;
+
+// Where the workers' book cursors start, random so consecutive runs do not replay the same positions
+static uint64_t bookOffset = 0;
+
 static void SignalHandler(int signal) {
     if (signal == SIGINT || signal == SIGTERM) {
         std::cout << "\n\nShutdown signal received. Saving data safely...\n" << std::flush;
@@ -234,77 +462,144 @@ static void SetupSignalHandlers() {
 static bool IsGameOver(Board &board, SEARCH::SearchContext* ctx) {
     if (SEARCH::IsDraw(board, ctx)) return true;
 
-    int moveSeen = 0;
-
-    for (int i = 0; i < board.currentMoveIndex; i++) {
-        if (!board.IsLegal(board.moveList[i])) continue;
-        Board copy = board;
-        copy.MakeMove(board.moveList[i]);
-        moveSeen++;
-    }
+    MoveList moveList;
+    MOVEGEN::GenerateMoves<All>(board, moveList);
 
-    return moveSeen == 0;
+    return moveList.count == 0;
 }
 
-static void PlayRandMoves(Board &board, SEARCH::SearchContext* ctx) {
+static void PlayRandMoves(Board &board, SEARCH::SearchContext* ctx, int moves) {
     std::random_device dev;
     std::mt19937_64 rng(dev());
 
     std::uniform_int_distribution<int> moveDist(0, 1);
     bool plusOne = moveDist(rng);
 
-    for (int count = 0; count < RAND_MOVES + plusOne; count++) {
-        MOVEGEN::GenerateMoves<All>(board, true);
+    MoveList moveList;
+
+    for (int count = 0; count < moves + plusOne; count++) {
+        MOVEGEN::GenerateMoves<All>(board, moveList);
 
-        if (board.currentMoveIndex <= 0) {
+        if (moveList.count <= 0) {
             break;
         }
 
-        std::uniform_int_distribution<int> dist(0, board.currentMoveIndex - 1);
+        std::uniform_int_distribution<int> dist(0, moveList.count - 1);
 
-        Move currMove = board.moveList[dist(rng)];
-        if (!board.IsLegal(currMove))  {
-            count--;
-            continue;
-        }
+        Move currMove = moveList[dist(rng)];
 
         board.MakeMove(currMove);
 
         ctx->positionHistory[board.positionIndex] = board.hashKey;
 
-        MOVEGEN::GenerateMoves<All>(board, true);
         if (IsGameOver(board, ctx)) break;
     }
 }
 
-static void WriteToFile(std::vector<Game> &gamesBuffer, const std::string& basePath, int& fileCounter) {
-    if (gamesBuffer.empty()) return;
+// Readies a worker's context for the next game. The TT is only aged, entries of earlier games are
+// replaced first, while the histories start from zero as they would in a fresh context
+static void ResetForNewGame(SEARCH::SearchContext* ctx) {
+    ctx->TT->IncreaseAge();
+    ctx->ClearHistories();
 
-    int32_t zeroes = 0;
-    std::vector<char> buffer;
+    ctx->ss = {};
+    ctx->excluded = Move();
+    ctx->minNmpPly = 0;
+    ctx->nodes = 0;
+
+    std::fill(ctx->positionHistory.begin(), ctx->positionHistory.end(), 0ULL);
+}
+
+// Bounded lock-free queue of finished games, pushed by every worker and drained by the writer thread.
+// Each cell carries a sequence number telling whether it is free for the lap a producer or the consumer is on
+template <typename T, size_t Capacity>
+class BoundedQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    std::array<Cell, Capacity> cells;
+
+    alignas(64) std::atomic<size_t> enqueuePos = 0;
+    alignas(64) std::atomic<size_t> dequeuePos = 0;
+
+public:
+    BoundedQueue() {
+        for (size_t i = 0; i < Capacity; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Returns false when the queue is full
+    bool TryPush(T&& value) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
 
-    size_t totalSize = 0;
-    for (const Game& game : gamesBuffer) {
-        totalSize += sizeof(game.format);
-        totalSize += sizeof(ScoredMove) * game.moves.size();
-        totalSize += sizeof(zeroes);
+        while (true) {
+            Cell& cell = cells[pos & (Capacity - 1)];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
     }
-    buffer.reserve(totalSize);
 
-    for (const Game& game : gamesBuffer) {
-        const char* formatPtr = reinterpret_cast<const char*>(&game.format);
-        buffer.insert(buffer.end(), formatPtr, formatPtr + sizeof(game.format));
+    // Only one thread may pop
+    bool TryPop(T& value) {
+        const size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Cell& cell = cells[pos & (Capacity - 1)];
 
-        const char* movesPtr = reinterpret_cast<const char*>(game.moves.data());
-        buffer.insert(buffer.end(), movesPtr, movesPtr + sizeof(ScoredMove) * game.moves.size());
+        if (cell.sequence.load(std::memory_order_acquire) != pos + 1)
+            return false;
 
-        const char* zeroesPtr = reinterpret_cast<const char*>(&zeroes);
-        buffer.insert(buffer.end(), zeroesPtr, zeroesPtr + sizeof(zeroes));
+        value = std::move(cell.data);
+        cell.sequence.store(pos + Capacity, std::memory_order_release);
+        dequeuePos.store(pos + 1, std::memory_order_relaxed);
+        return true;
     }
+};
+
+static BoundedQueue<Game, GAME_QUEUE_SIZE> gameQueue;
+
+// Workers only wait here if the writer has fallen a whole queue behind
+static void PushGame(Game&& game) {
+    while (!gameQueue.TryPush(std::move(game)))
+        std::this_thread::yield();
+}
+
+static void AppendGame(std::vector<char>& buffer, const Game& game) {
+    const int32_t zeroes = 0;
+
+    const char* formatPtr = reinterpret_cast<const char*>(&game.format);
+    buffer.insert(buffer.end(), formatPtr, formatPtr + sizeof(game.format));
+
+    const char* movesPtr = reinterpret_cast<const char*>(game.moves.data());
+    buffer.insert(buffer.end(), movesPtr, movesPtr + sizeof(ScoredMove) * game.moves.size());
+
+    const char* zeroesPtr = reinterpret_cast<const char*>(&zeroes);
+    buffer.insert(buffer.end(), zeroesPtr, zeroesPtr + sizeof(zeroes));
+}
+
+// Writes one checkpoint with a single sequential write. Only this file is flushed to disk
+// before it is renamed into place, so a crash leaves either the whole checkpoint or none of it
+static void WriteToFile(const std::vector<char>& buffer, const std::string& basePath, int& fileCounter) {
+    if (buffer.empty()) return;
 
     std::string tmpFileName = basePath + std::to_string(fileCounter) + ".tmp";
     std::string finalFileName = basePath + std::to_string(fileCounter) + ".binpack";
 
+#ifdef _WIN32
     std::ofstream tmpFile(tmpFileName, std::ios::binary);
     if (!tmpFile.is_open()) {
         std::cerr << "Failed to create temporary file: " << tmpFileName << std::endl;
@@ -312,13 +607,35 @@ static void WriteToFile(std::vector<Game> &gamesBuffer, const std::string& baseP
     }
 
     tmpFile.write(buffer.data(), buffer.size());
-    tmpFile.flush();
-
-#ifdef _WIN32
     tmpFile.close();
 #else
-    tmpFile.close();
-    sync();
+    int fd = open(tmpFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to create temporary file: " << tmpFileName << std::endl;
+        return;
+    }
+
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t result = write(fd, buffer.data() + written, buffer.size() - written);
+
+        if (result < 0) {
+            if (errno == EINTR) continue;
+
+            std::cerr << "Failed to write " << tmpFileName << ": " << std::strerror(errno) << std::endl;
+            close(fd);
+            return;
+        }
+
+        written += result;
+    }
+
+    #ifdef __APPLE__
+        fsync(fd);
+    #else
+        fdatasync(fd);
+    #endif
+    close(fd);
 #endif
 
     std::error_code ec;
@@ -333,6 +650,116 @@ static void WriteToFile(std::vector<Game> &gamesBuffer, const std::string& baseP
     fileCounter++;
 }
 
+// Drains the queue into one large buffer and writes a checkpoint every GAME_BUFFER games.
+// Once done is set and the queue is empty, the remaining games are written and the thread exits
+static void WriterThread(std::atomic<bool>& done) {
+    std::filesystem::create_directories("data");
+
+    const std::string basePath = "data/thread_writer_";
+    int fileCounter = 0;
+
+    std::vector<char> buffer;
+    buffer.reserve(WRITE_BUFFER_BYTES);
+
+    int bufferedGames = 0;
+    Game game;
+
+    while (true) {
+        // Read before draining, the workers have all finished pushing by the time it is set
+        const bool finished = done.load();
+
+        while (gameQueue.TryPop(game)) {
+            AppendGame(buffer, game);
+
+            if (++bufferedGames >= GAME_BUFFER) {
+                WriteToFile(buffer, basePath, fileCounter);
+                buffer.clear();
+                bufferedGames = 0;
+            }
+        }
+
+        if (finished) break;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    WriteToFile(buffer, basePath, fileCounter);
+}
+
+#ifdef __linux__
+// Appends a part to the merged file inside the kernel. copy_file_range shares the extents instead of copying
+// on filesystems with reflinks, other filesystems or kernels fall back to a plain copy with a large buffer
+static bool CopyPart(int outFd, const std::filesystem::path& part) {
+    int inFd = open(part.c_str(), O_RDONLY);
+    if (inFd < 0) return false;
+
+    struct stat info;
+    if (fstat(inFd, &info) != 0) {
+        close(inFd);
+        return false;
+    }
+
+    off_t remaining = info.st_size;
+    bool kernelCopy = true;
+
+    while (remaining > 0 && kernelCopy) {
+        ssize_t copied = copy_file_range(inFd, nullptr, outFd, nullptr, remaining, 0);
+
+        if (copied > 0) {
+            remaining -= copied;
+        } else if (copied < 0 && errno == EINTR) {
+            continue;
+        } else {
+            kernelCopy = false;
+        }
+    }
+
+    std::vector<char> buffer(remaining > 0 ? WRITE_BUFFER_BYTES : 0);
+
+    while (remaining > 0) {
+        ssize_t bytesRead = read(inFd, buffer.data(), buffer.size());
+
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead <= 0) break;
+
+        ssize_t written = 0;
+        while (written < bytesRead) {
+            ssize_t result = write(outFd, buffer.data() + written, bytesRead - written);
+
+            if (result < 0 && errno == EINTR) continue;
+            if (result < 0) {
+                close(inFd);
+                return false;
+            }
+
+            written += result;
+        }
+
+        remaining -= bytesRead;
+    }
+
+    close(inFd);
+    return remaining == 0;
+}
+
+// A part that fails halfway is cut off the merged file again, so its games are only in the kept part
+static bool AppendPart(int outFd, const std::filesystem::path& part) {
+    const off_t start = lseek(outFd, 0, SEEK_CUR);
+    if (start < 0) return false;
+
+    if (CopyPart(outFd, part)) return true;
+
+    const int error = errno;
+
+    if (ftruncate(outFd, start) != 0 || lseek(outFd, start, SEEK_SET) != start) {
+        std::cerr << "Failed to cut " << part.filename().string() << " off the merged file, it may hold a partial copy" << std::endl;
+    }
+
+    errno = error;
+    return false;
+}
+#endif
+
 static std::string MergeThreadFiles() {
     namespace fs = std::filesystem;
 
@@ -348,11 +775,19 @@ static std::string MergeThreadFiles() {
         << ".binpack";
     std::string finalFileName = oss.str();
 
+#ifdef __linux__
+    int finalFd = open(finalFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (finalFd < 0) {
+        std::cerr << "Failed to create final merged file: " << finalFileName << std::endl;
+        return "";
+    }
+#else
     std::ofstream finalFile(finalFileName, std::ios::binary);
     if (!finalFile.is_open()) {
         std::cerr << "Failed to create final merged file: " << finalFileName << std::endl;
         return "";
     }
+#endif
 
     fs::path dataDir("data");
     for (const auto& entry : fs::directory_iterator(dataDir)) {
@@ -360,6 +795,13 @@ static std::string MergeThreadFiles() {
         std::string filename = entry.path().filename().string();
 
         if (filename.find("thread") == 0 && filename.find(".binpack") != std::string::npos) {
+#ifdef __linux__
+            // A failed part is kept so its games are not lost
+            if (!AppendPart(finalFd, entry.path())) {
+                std::cerr << "Failed to merge " << filename << ": " << std::strerror(errno) << std::endl;
+                continue;
+            }
+#else
             std::ifstream threadFile(entry.path(), std::ios::binary);
             if (!threadFile.is_open()) {
                 std::cerr << "Failed to open " << filename << std::endl;
@@ -368,7 +810,9 @@ static std::string MergeThreadFiles() {
 
             finalFile << threadFile.rdbuf();
             threadFile.close();
+#endif
 
+            // Removed as soon as it is merged, so at most one part is on disk twice when extents cannot be shared
             std::error_code ec;
             fs::remove(entry.path(), ec);
             if (ec) {
@@ -390,87 +834,99 @@ static std::string MergeThreadFiles() {
         }
     }
 
+#ifdef __linux__
+    close(finalFd);
+#else
     finalFile.close();
+#endif
     std::cout << "Merged all thread files into: " << finalFileName << std::endl;
     return finalFileName;
 }
 
-static void PlayGames(int id, std::atomic<int>& positions, std::atomic<bool>& stopFlag) {
-    std::vector<Game> gamesBuffer;
-    gamesBuffer.reserve(GAME_BUFFER);
+static void PlayGames(int id, PositionCounter& counter, std::atomic<bool>& stopFlag) {
+    const int evenityMargin = 200;
+
+    // Allocated once per worker and reused by every game it plays
+    TTable datagenTT;
+    if (!datagenTT.Resize(workerOptions.hashMB * MB / sizeof(TTCluster), 1)) {
+        std::cerr << "Failed to allocate " << workerOptions.hashMB << " MB of hash, using "
+                  << datagenTT.GetSizeMB() << " MB" << std::endl;
+    }
 
-    std::filesystem::create_directories("data");
+    auto ctx = std::make_unique<SEARCH::SearchContext>();
+    ctx->TT = &datagenTT;
 
-    std::string basePath = "data/thread" + std::to_string(id) + "_";
-    int fileCounter = 0;
+    // Workers take every workerCount-th book position, so they only meet again once the book wraps around
+    uint64_t bookCursor = bookOffset + id;
 
-    const int evenityMargin = 200;
+    while (!stopFlag && !g_shutdownRequested) {
+        Board board;
+        ResetForNewGame(ctx.get());
 
-    try {
-        while (!stopFlag && !g_shutdownRequested) {
-            Board board;
-            TTable DatagenTT;
-            auto ctx = std::make_unique<SEARCH::SearchContext>();
-            ctx->TT = &DatagenTT;
+        if (workerBook) {
+            board.SetByFen(workerBook->GetFen(bookCursor));
+            bookCursor += workerCount;
 
-            PlayRandMoves(board, ctx.get());
+            PlayRandMoves(board, ctx.get(), BOOK_RAND_MOVES);
             if (IsGameOver(board, ctx.get())) continue;
 
-            const int startingScore = SEARCH::SearchPosition<SEARCH::datagen>(board, SearchParams(), ctx.get()).score;
+            // The book is trusted to be balanced unless asked to check. The check is the same search as for
+            // random openings, with the soft node limit lowered to verifyNodes
+            if (workerOptions.verifyNodes > 0) {
+                SearchParams params;
+                params.nodes = workerOptions.verifyNodes;
 
-            if (std::abs(startingScore) >= evenityMargin) continue;
+                const int startingScore = SEARCH::SearchPosition<SEARCH::datagen>(board, params, ctx.get()).score;
 
-            ctx->nodes = 0;
+                if (std::abs(startingScore) >= evenityMargin) continue;
+            }
+        } else {
+            PlayRandMoves(board, ctx.get(), RAND_MOVES);
+            if (IsGameOver(board, ctx.get())) continue;
 
-            Game game;
-            Board startpos = board;
+            const int startingScore = SEARCH::SearchPosition<SEARCH::datagen>(board, SearchParams(), ctx.get()).score;
 
-            SearchResults safeResults;
+            if (std::abs(startingScore) >= evenityMargin) continue;
+        }
 
-            int staticEval = UTILS::ConvertToWhiteRelative(board, NNUE::net.Evaluate(board, true));
-            int wdl = 1;
+        ctx->nodes = 0;
 
-            while (!IsGameOver(board, ctx.get())) {
-                if (g_shutdownRequested) break;
+        Game game;
+        Board startpos = board;
 
-                SearchResults results = SEARCH::SearchPosition<SEARCH::datagen>(board, SearchParams(), ctx.get());
+        SearchResults safeResults;
 
-                if (!results.bestMove) break;
-                safeResults = results;
+        int staticEval = UTILS::ConvertToWhiteRelative(board, NNUE::net->Evaluate(board, true));
+        int wdl = 1;
 
-                game.moves.emplace_back(ScoredMove(results.bestMove.ConvertToViriMoveFormat(),
-                        UTILS::ConvertToWhiteRelative(board, results.score)));
+        // Counted locally and published once per game
+        uint64_t gamePositions = 0;
 
-                board.MakeMove(results.bestMove);
-                ctx->positionHistory[board.positionIndex] = board.hashKey;
+        while (!IsGameOver(board, ctx.get())) {
+            if (g_shutdownRequested) break;
 
-                positions++;
+            SearchResults results = SEARCH::SearchPosition<SEARCH::datagen>(board, SearchParams(), ctx.get());
 
-                MOVEGEN::GenerateMoves<All>(board, true);
-            }
+            if (!results.bestMove) break;
+            safeResults = results;
 
-            if (!SEARCH::IsDraw(board, ctx.get())) {
-                wdl = board.sideToMove ? 2 : 0;
-            }
+            game.moves.emplace_back(ScoredMove(results.bestMove.ConvertToViriMoveFormat(),
+                    UTILS::ConvertToWhiteRelative(board, results.score)));
 
-            game.format.packFrom(startpos, staticEval, wdl);
-            gamesBuffer.emplace_back(game);
+            board.MakeMove(results.bestMove);
+            ctx->positionHistory[board.positionIndex] = board.hashKey;
 
-            if (gamesBuffer.size() >= GAME_BUFFER) {
-                WriteToFile(gamesBuffer, basePath, fileCounter);
-                gamesBuffer.clear();
-            }
+            gamePositions++;
         }
-    } catch (...) {
-        if (!gamesBuffer.empty()) {
-            WriteToFile(gamesBuffer, basePath, fileCounter);
+
+        counter.count.fetch_add(gamePositions, std::memory_order_relaxed);
+
+        if (!SEARCH::IsDraw(board, ctx.get())) {
+            wdl = board.sideToMove ? 2 : 0;
         }
-        throw;
-    }
 
-    if (!gamesBuffer.empty()) {
-        WriteToFile(gamesBuffer, basePath, fileCounter);
-        gamesBuffer.clear();
+        game.format.packFrom(startpos, staticEval, wdl);
+        PushGame(std::move(game));
     }
 
     if (!stopFlag.load() && !g_shutdownRequested.load()) {
@@ -482,23 +938,23 @@ static void PlayGames(int id, std::atomic<int>& positions, std::atomic<bool>& st
 
 struct WinThreadArgs {
     int id;
-    std::atomic<int>* positions;
+    PositionCounter* counter;
     std::atomic<bool>* stopFlag;
 };
 
 static unsigned __stdcall WinThreadEntry(void* p) {
     std::unique_ptr<WinThreadArgs> args(static_cast<WinThreadArgs*>(p));
-    PlayGames(args->id, *args->positions, *args->stopFlag);
+    PlayGames(args->id, *args->counter, *args->stopFlag);
     _endthreadex(0);
     return 0;
 }
 
 static bool CreateWorkerThread(int id,
-                               std::atomic<int>& positions,
+                               PositionCounter& counter,
                                std::atomic<bool>& stopFlag,
                                std::vector<HANDLE>& threads,
                                size_t stackSizeBytes) {
-    auto* args = new WinThreadArgs{ id, &positions, &stopFlag };
+    auto* args = new WinThreadArgs{ id, &counter, &stopFlag };
 
     unsigned tid = 0;
     HANDLE h = reinterpret_cast<HANDLE>(
@@ -535,7 +991,7 @@ static void JoinWorkerThreads(std::vector<HANDLE>& threads) {
 #else
 
 static void* ThreadFunc(void* arg) {
-    auto* tup = static_cast<std::tuple<int, std::atomic<int>*, std::atomic<bool>*>*>(arg);
+    auto* tup = static_cast<std::tuple<int, PositionCounter*, std::atomic<bool>*>*>(arg);
     PlayGames(std::get<0>(*tup), *std::get<1>(*tup), *std::get<2>(*tup));
     delete tup;
     return nullptr;
@@ -543,7 +999,33 @@ static void* ThreadFunc(void* arg) {
 
 #endif
 
-void Run(int targetPositions, int threads) {
+// Opens the book named in the options, if any, and hands the options to the workers about to start
+static bool SetupWorkers(const DatagenOptions& options, int threads, OpeningBook& book) {
+    workerOptions = options;
+    workerCount = std::max(threads - 1, 1);
+    workerBook = nullptr;
+
+    if (options.bookPath.empty()) return true;
+
+    if (!book.Open(options.bookPath)) {
+        std::cerr << "Failed to open book " << options.bookPath << " or it holds no valid positions" << std::endl;
+        return false;
+    }
+
+    std::random_device rd;
+    bookOffset = std::uniform_int_distribution<uint64_t>(0, book.Count() - 1)(rd);
+    workerBook = &book;
+
+    std::cout << "Book: " << options.bookPath << " (" << book.Count() << " positions";
+    if (book.Skipped()) std::cout << ", " << book.Skipped() << " invalid lines skipped";
+    std::cout << ")" << std::endl;
+    return true;
+}
+
+void Run(uint64_t targetPositions, int threads, const DatagenOptions& options) {
+    OpeningBook book;
+    if (!SetupWorkers(options, threads, book)) return;
+
     SetupSignalHandlers();
 
 #ifdef _WIN32
@@ -554,9 +1036,12 @@ void Run(int targetPositions, int threads) {
     HideCursor();
 #endif
 
-    std::atomic<int> positions = 0;
+    PositionCounters positions(threads - 1);
     std::atomic<bool> stopFlag = false;
 
+    std::atomic<bool> writerDone = false;
+    std::thread writer(WriterThread, std::ref(writerDone));
+
 #ifdef _WIN32
     std::vector<HANDLE> workerThreads;
     workerThreads.reserve((threads > 1) ? (threads - 1) : 0);
@@ -564,7 +1049,7 @@ void Run(int targetPositions, int threads) {
     const size_t stackSizeBytes = 8ull * 1024ull * 1024ull;
 
     for (int i = 0; i < threads - 1; ++i) {
-        CreateWorkerThread(i, positions, stopFlag, workerThreads, stackSizeBytes);
+        CreateWorkerThread(i, positions[i], stopFlag, workerThreads, stackSizeBytes);
     }
 #else
     std::vector<pthread_t> workerThreads;
@@ -574,7 +1059,7 @@ void Run(int targetPositions, int threads) {
         pthread_attr_init(&attr);
         pthread_attr_setstacksize(&attr, 8 * 1024 * 1024);
 
-        auto* args = new std::tuple<int, std::atomic<int>*, std::atomic<bool>*>(i, &positions, &stopFlag);
+        auto* args = new std::tuple<int, PositionCounter*, std::atomic<bool>*>(i, &positions[i], &stopFlag);
 
         pthread_t thread;
         if (pthread_create(&thread, &attr, ThreadFunc, args) == 0) {
@@ -589,12 +1074,12 @@ void Run(int targetPositions, int threads) {
 #endif
 
     Stopwatch sw;
-    while (positions < targetPositions && !g_shutdownRequested) {
-        PrintProgress(positions, targetPositions, sw, threads);
+    while (positions.Total() < targetPositions && !g_shutdownRequested) {
+        PrintProgress(positions.Total(), targetPositions, sw, threads);
         std::this_thread::sleep_for(std::chrono::seconds(1));
     }
 
-    PrintProgress(positions, targetPositions, sw, threads);
+    PrintProgress(positions.Total(), targetPositions, sw, threads);
 
     stopFlag = true;
 
@@ -608,6 +1093,9 @@ void Run(int targetPositions, int threads) {
     }
 #endif
 
+    writerDone = true;
+    writer.join();
+
     std::cout << "All threads completed. Merging files..." << std::endl;
     MergeThreadFiles();
 
@@ -620,15 +1108,19 @@ void Run(int targetPositions, int threads) {
     std::cout << "\nShutdown complete. All data saved safely." << std::endl;
 }
 
-void RunOnline(const std::string& username, int targetPositions, int threads) {
+void RunOnline(const std::string& username, uint64_t targetPositions, int threads, const DatagenOptions& options) {
     const std::string SERVER_URL = "http://13.60.26.163:3000";
 
+    OpeningBook book;
+    if (!SetupWorkers(options, threads, book)) return;
+
     SetupSignalHandlers();
 
     std::cout << "=== ONLINE MODE ===" << std::endl;
     std::cout << "User: " << username << std::endl;
     std::cout << "Target positions per cycle: " << targetPositions << std::endl;
     std::cout << "Threads: " << threads << std::endl;
+    std::cout << "Hash per thread: " << options.hashMB << " MB" << std::endl;
     std::cout << "===================" << std::endl << std::endl;
 
     while (!g_shutdownRequested) {
@@ -676,9 +1168,12 @@ void RunOnline(const std::string& username, int targetPositions, int threads) {
         HideCursor();
 #endif
 
-        std::atomic<int> positions = 0;
+        PositionCounters positions(threads - 1);
         std::atomic<bool> stopFlag = false;
 
+        std::atomic<bool> writerDone = false;
+        std::thread writer(WriterThread, std::ref(writerDone));
+
 #ifdef _WIN32
         std::vector<HANDLE> workerThreads;
         workerThreads.reserve((threads > 1) ? (threads - 1) : 0);
@@ -686,7 +1181,7 @@ void RunOnline(const std::string& username, int targetPositions, int threads) {
         const size_t stackSizeBytes = 8ull * 1024ull * 1024ull;
 
         for (int i = 0; i < threads - 1; ++i) {
-            CreateWorkerThread(i, positions, stopFlag, workerThreads, stackSizeBytes);
+            CreateWorkerThread(i, positions[i], stopFlag, workerThreads, stackSizeBytes);
         }
 #else
         std::vector<pthread_t> workerThreads;
@@ -696,7 +1191,7 @@ void RunOnline(const std::string& username, int targetPositions, int threads) {
             pthread_attr_init(&attr);
             pthread_attr_setstacksize(&attr, 8 * 1024 * 1024);
 
-            auto* args = new std::tuple<int, std::atomic<int>*, std::atomic<bool>*>(i, &positions, &stopFlag);
+            auto* args = new std::tuple<int, PositionCounter*, std::atomic<bool>*>(i, &positions[i], &stopFlag);
 
             pthread_t thread;
             if (pthread_create(&thread, &attr, ThreadFunc, args) == 0) {
@@ -711,12 +1206,12 @@ void RunOnline(const std::string& username, int targetPositions, int threads) {
 #endif
 
         Stopwatch sw;
-        while (positions < targetPositions && !g_shutdownRequested) {
-            PrintProgress(positions, targetPositions, sw, threads);
+        while (positions.Total() < targetPositions && !g_shutdownRequested) {
+            PrintProgress(positions.Total(), targetPositions, sw, threads);
             std::this_thread::sleep_for(std::chrono::seconds(1));
         }
 
-        PrintProgress(positions, targetPositions, sw, threads);
+        PrintProgress(positions.Total(), targetPositions, sw, threads);
 
         stopFlag = true;
 
@@ -730,6 +1225,9 @@ void RunOnline(const std::string& username, int targetPositions, int threads) {
         }
 #endif
 
+        writerDone = true;
+        writer.join();
+
         heartbeatStop = true;
         if (heartbeat.joinable()) {
             heartbeat.join();
@@ -750,7 +1248,7 @@ void RunOnline(const std::string& username, int targetPositions, int threads) {
             std::cout << "Uploading file to server..." << std::endl;
             std::string uploadUrl = SERVER_URL + "/api/upload/" + sessionId;
 
-            if (UploadFile(uploadUrl, mergedFile, username, positions.load())) {
+            if (UploadFile(uploadUrl, mergedFile, username, positions.Total())) {
                 std::cout << "Upload successful!" << std::endl;
 
                 std::error_code ec;
@@ -772,7 +1270,7 @@ void RunOnline(const std::string& username, int targetPositions, int threads) {
     std::cout << "\nOnline mode shutdown complete." << std::endl;
 }
 
-void PrintProgress(int positions, int targetPositions, Stopwatch &stopwatch, int threads) {
+void PrintProgress(uint64_t positions, uint64_t targetPositions, Stopwatch &stopwatch, int threads) {
     const std::string COLOR_RESET = "\033[0m";
     const std::string COLOR_TITLE = "\033[1;36m";
     const std::string COLOR_SECTION = "\033[1;33m";
@@ -833,7 +1331,7 @@ void PrintProgress(int positions, int targetPositions, Stopwatch &stopwatch, int
     double remainingTime = 0.0;
     if (positions > 0 && elapsed > 0.0) {
         double pps = positions / elapsed;
-        remainingTime = (targetPositions - positions) / pps;
+        remainingTime = (double(targetPositions) - double(positions)) / pps;
     }
 
     remainingTime = (std::max)(0.0, remainingTime);
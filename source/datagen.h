@@ -3,13 +3,65 @@
 #include "utils.h"
 #include <fstream>
 #include "stopwatch.h"
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <string>
 
 namespace DATAGEN {
 
+// Games per checkpoint file written by the writer thread
 constexpr int GAME_BUFFER = 500;
+// Finished games that can wait for the writer before workers have to
+constexpr size_t GAME_QUEUE_SIZE = 4096;
+constexpr size_t WRITE_BUFFER_BYTES = 8 * 1024 * 1024;
 constexpr int SOFT_NODES = 5000;
 constexpr int HARD_NODES = 100000;
 constexpr int RAND_MOVES = 8;
+// Random plies played after a book position, only to keep games from the same line apart
+constexpr int BOOK_RAND_MOVES = 2;
+
+// TT size of each worker in MB, the table lives as long as the worker
+constexpr int DEFAULT_HASH_MB = 8;
+
+struct DatagenOptions {
+    int hashMB = DEFAULT_HASH_MB;
+
+    // EPD or FEN file the games start from, empty for random openings
+    std::string bookPath;
+
+    // Soft node limit of the search that checks a book position is balanced before it is played, capped by
+    // HARD_NODES. 0 trusts the book
+    int verifyNodes = 0;
+};
+
+// Positions played by one worker, alone on its cache line so no two workers ever write to the same one
+struct alignas(64) PositionCounter {
+    std::atomic<uint64_t> count = 0;
+};
+
+// The workers' counters, summed whenever the progress display or the stop condition needs a total
+class PositionCounters {
+private:
+    std::unique_ptr<PositionCounter[]> counters;
+    int size;
+public:
+    explicit PositionCounters(int workers)
+        : counters(std::make_unique<PositionCounter[]>(std::max(workers, 1))), size(std::max(workers, 1)) {}
+
+    PositionCounter& operator[](int id) {
+        return counters[id];
+    }
+
+    uint64_t Total() const {
+        uint64_t total = 0;
+
+        for (int i = 0; i < size; i++)
+            total += counters[i].count.load(std::memory_order_relaxed);
+
+        return total;
+    }
+};
 
 struct MarlinFormat {
     uint64_t occupancy;      // 8 bytes: Bitboard representing all occupied squares (includes all pieces)
@@ -60,8 +112,8 @@ struct Game {
     }
 };
 
-void Run(int targetPositions, int threads);
-void RunOnline(const std::string& username, int targetPositions, int threads);
+void Run(uint64_t targetPositions, int threads, const DatagenOptions& options = {});
+void RunOnline(const std::string& username, uint64_t targetPositions, int threads, const DatagenOptions& options = {});
 
-void PrintProgress(int positions, int targetPositions, Stopwatch &stopwatch, int threads);
+void PrintProgress(uint64_t positions, uint64_t targetPositions, Stopwatch &stopwatch, int threads);
 }
@@ -7,6 +7,7 @@
 #include "datagen.h"
 #include "nnue.h"
 #include "tests.h"
+#include "perft.h"
 
 #ifndef EVALFILE
     #define EVALFILE "./nnue.bin"
@@ -30,23 +31,17 @@ INCBIN(EVAL, EVALFILE);
 #endif
 
 int main(int argc, char* argv[]) {
-    auto loadDefaultNet = [&]([[maybe_unused]] bool warnMSVC = false) {
     #if defined(_MSC_VER) && !defined(__clang__)
-            NNUE::net.Load(EVALFILE);
-            if (warnMSVC)
-                cerr << "WARNING: This file was compiled with MSVC, this means that an nnue was NOT embedded into the exe." << endl;
+        cerr << "WARNING: This file was compiled with MSVC, this means that an nnue was NOT embedded into the exe." << endl;
+        NNUE::LoadNetwork(EVALFILE);
     #else
-            NNUE::net = *reinterpret_cast<const NNUE::Network*>(gEVALData);
+        NNUE::SetEmbeddedNetwork(gEVALData, gEVALSize);
     #endif
-        };
-    
-    loadDefaultNet(true);
 
-        
+    if (!NNUE::net) {
+        return 1;
+    }
 
-	MOVEGEN::initLeaperAttacks();
-	MOVEGEN::initSliderAttacks();
-    UTILS::InitZobrist();
     #ifdef TUNING
         SEARCH::RefreshTunableCaches();
     #else
@@ -58,26 +53,82 @@ int main(int argc, char* argv[]) {
     if (argc > 1) {
         if (std::string(argv[1]) == "bench") {
             RunBenchmark();
+        } else if (std::string(argv[1]) == "perft") {
+            // perft <depth> [threads=<n>] [hash=<mb>], from the starting position
+            int depth = argc > 2 ? std::stoi(argv[2]) : 6;
+            int threads = defaultPerftThreads;
+            int hashMB = defaultPerftHashMB;
+
+            for (int i = 3; i < argc; i++) {
+                std::string arg = argv[i];
+
+                if (arg.rfind("threads=", 0) == 0) {
+                    threads = std::stoi(arg.substr(8));
+                } else if (arg.rfind("hash=", 0) == 0) {
+                    hashMB = std::stoi(arg.substr(5));
+                }
+            }
+
+            Perft(board, depth, threads, hashMB);
+        } else if (std::string(argv[1]) == "perftsuite") {
+            // perftsuite [file] [threads=<n>] [hash=<mb>], exits with 1 on any mismatch
+            std::string path = "tests/perftsuite.epd";
+            int threads = defaultPerftThreads;
+            int hashMB = defaultPerftHashMB;
+
+            for (int i = 2; i < argc; i++) {
+                std::string arg = argv[i];
+
+                if (arg.rfind("threads=", 0) == 0) {
+                    threads = std::stoi(arg.substr(8));
+                } else if (arg.rfind("hash=", 0) == 0) {
+                    hashMB = std::stoi(arg.substr(5));
+                } else {
+                    path = arg;
+                }
+            }
+
+            return TEST::PerftSuite(path, threads, hashMB) ? 0 : 1;
+        } else if (std::string(argv[1]) == "nettest") {
+            // Exits with 1 if a damaged network file loads or an intact one does not
+            return TEST::NetworkFiles() ? 0 : 1;
         } else if (std::string(argv[1]) == "datagen") {
-            int positions = 1;
+            // datagen [positions in K] [threads] [username] [hash=<mb per thread>] [book=<epd>] [verify=<nodes>]
+            uint64_t positions = 1;
             int threads = 1;
+            DATAGEN::DatagenOptions options;
             std::string username = "";
+
+            std::vector<std::string> args;
+            for (int i = 2; i < argc; i++) {
+                std::string arg = argv[i];
+
+                if (arg.rfind("hash=", 0) == 0) {
+                    options.hashMB = std::clamp<U64>(std::stoull(arg.substr(5)), 1, maxHashMB);
+                } else if (arg.rfind("book=", 0) == 0) {
+                    options.bookPath = arg.substr(5);
+                } else if (arg.rfind("verify=", 0) == 0) {
+                    options.verifyNodes = std::stoi(arg.substr(7));
+                } else {
+                    args.push_back(arg);
+                }
+            }
             
-            if (argc > 2) {
-                positions = std::stoi(argv[2]) * 1000;
-                if (argc > 3) {
-                    threads = std::stoi(argv[3]);
-                    if (argc > 4) {
+            if (args.size() > 0) {
+                positions = std::stoull(args[0]) * 1000;
+                if (args.size() > 1) {
+                    threads = std::stoi(args[1]);
+                    if (args.size() > 2) {
 
-                        username = argv[4];
+                        username = args[2];
                     }
                 }
             }
             
             if (!username.empty()) {
-                DATAGEN::RunOnline(username, positions, threads);
+                DATAGEN::RunOnline(username, positions, threads, options);
             } else {
-                DATAGEN::Run(positions, threads);
+                DATAGEN::Run(positions, threads, options);
             }
         }
     } else {
@@ -0,0 +1,97 @@
+#include "memory.h"
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+    #include <malloc.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+namespace MEMORY {
+
+constexpr size_t LARGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static size_t RoundUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+#ifdef __linux__
+// madvise succeeds even when transparent huge pages are disabled system-wide
+static bool TransparentHugePagesEnabled() {
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string mode;
+    std::getline(file, mode);
+
+    return file && mode.find("[never]") == std::string::npos;
+}
+#endif
+
+LargeAllocation AllocateLarge(size_t size) {
+    LargeAllocation allocation;
+
+#ifdef _WIN32
+    // Large pages on Windows need the "Lock pages in memory" privilege, plain aligned memory is used instead
+    allocation.size = RoundUp(size, LARGE_PAGE_SIZE);
+    allocation.data = _aligned_malloc(allocation.size, LARGE_PAGE_SIZE);
+#else
+    allocation.size = RoundUp(size, LARGE_PAGE_SIZE);
+
+    #if defined(MAP_HUGETLB)
+        void* data = mmap(nullptr, allocation.size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (data != MAP_FAILED) {
+            allocation.data = data;
+            allocation.backing = Backing::HugeTLB;
+            return allocation;
+        }
+    #endif
+
+    allocation.data = std::aligned_alloc(LARGE_PAGE_SIZE, allocation.size);
+
+    #if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if (allocation.data && TransparentHugePagesEnabled()
+            && madvise(allocation.data, allocation.size, MADV_HUGEPAGE) == 0) {
+            allocation.backing = Backing::TransparentHugePages;
+        }
+    #endif
+#endif
+
+    if (!allocation.data) {
+        allocation.size = 0;
+    }
+
+    return allocation;
+}
+
+void FreeLarge(LargeAllocation& allocation) {
+    if (!allocation.data)
+        return;
+
+#ifdef _WIN32
+    _aligned_free(allocation.data);
+#else
+    if (allocation.backing == Backing::HugeTLB) {
+        munmap(allocation.data, allocation.size);
+    } else {
+        std::free(allocation.data);
+    }
+#endif
+
+    allocation = LargeAllocation();
+}
+
+std::string_view BackingName(Backing backing) {
+    switch (backing) {
+        case Backing::HugeTLB:
+            return "explicit huge pages";
+        case Backing::TransparentHugePages:
+            return "transparent huge pages";
+        default:
+            return "regular pages";
+    }
+}
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+namespace MEMORY {
+
+enum class Backing {
+    Regular,
+    TransparentHugePages,
+    HugeTLB
+};
+
+struct LargeAllocation {
+    void* data = nullptr;
+    size_t size = 0;
+    Backing backing = Backing::Regular;
+};
+
+// Allocates memory aligned for large pages. Tries explicit huge pages first, then transparent huge pages,
+// then falls back to a regular aligned allocation. Memory is not zeroed
+LargeAllocation AllocateLarge(size_t size);
+void FreeLarge(LargeAllocation& allocation);
+
+std::string_view BackingName(Backing backing);
+
+}
@@ -1,71 +1,84 @@
 #include "movegen.h"
 
+// Slider attacks are indexed with PEXT when the target has BMI2, unless NO_PEXT is defined for CPUs where
+// PEXT is microcoded. The tables are the same for both backends, only the index calculation differs
+#if defined(__BMI2__) && !defined(NO_PEXT)
+    #include <immintrin.h>
+    #define USE_PEXT
+    #define SLIDER_BACKEND "PEXT"
+#else
+    #define SLIDER_BACKEND "magic"
+#endif
+
+#pragma message("Using " SLIDER_BACKEND " slider attacks")
+
 namespace MOVEGEN {
 
-static Bitboard bishopMasks[64];
-static Bitboard rookMasks[64];
+// All attack tables below are built by the compiler, so nothing has to be initialised at startup
 
-static Bitboard bishopAttacks[64][512];
-static Bitboard rookAttacks[64][4096];
+static constexpr U64 notAfile = ~files[A];
+static constexpr U64 notHfile = ~files[H];
+static constexpr U64 notABfile = notAfile & ~files[B];
+static constexpr U64 notHGfile = notHfile & ~files[G];
 
-static Bitboard notAfile = ~files[A];
-static Bitboard notHfile = ~files[H];
-static Bitboard notABfile = notAfile & ~files[B];
-static Bitboard notHGfile = notHfile & ~files[G];
+// Shifts towards a direction, negative directions shift right
+static constexpr U64 shift(U64 bitboard, int direction) {
+	return direction > 0 ? bitboard << direction : bitboard >> -direction;
+}
 
-static Bitboard maskPawnAttacks(int side, int square) {
-	Bitboard attacks;
-	Bitboard attacker = Bitboard::GetSquare(square);
+static constexpr U64 maskPawnAttacks(int side, int square) {
+	U64 attacks = 0ULL;
+	U64 attacker = 1ULL << square;
 
 	// White
 	if (!side) {
-		if (((attacker << noEa) & notAfile)) attacks |= (attacker << noEa);
-		if (((attacker << noWe) & notHfile)) attacks |= (attacker << noWe);
+		if ((shift(attacker, noEa) & notAfile)) attacks |= shift(attacker, noEa);
+		if ((shift(attacker, noWe) & notHfile)) attacks |= shift(attacker, noWe);
 	}
 	// Black
 	else {
-		if (((attacker << soEa) & notAfile)) attacks |= (attacker << soEa);
-		if (((attacker << soWe) & notHfile)) attacks |= (attacker << soWe);
+		if ((shift(attacker, soEa) & notAfile)) attacks |= shift(attacker, soEa);
+		if ((shift(attacker, soWe) & notHfile)) attacks |= shift(attacker, soWe);
 	}
 	return attacks;
 }
 
-static Bitboard maskKnightAttacks(int square) {
-	Bitboard attacks;
-	Bitboard attacker = Bitboard::GetSquare(square);
+static constexpr U64 maskKnightAttacks(int square) {
+	U64 attacks = 0ULL;
+	U64 attacker = 1ULL << square;
 
-	if (((attacker << noEa + north) & notAfile)) attacks |= (attacker << noEa + north);
-	if (((attacker << noWe + north) & notHfile)) attacks |= (attacker << noWe + north);
-	if (((attacker << noWe + west) & notHGfile)) attacks |= (attacker << noWe + west);
-	if (((attacker << noEa + east) & notABfile)) attacks |= (attacker << noEa + east);
+	if ((shift(attacker, noEa + north) & notAfile)) attacks |= shift(attacker, noEa + north);
+	if ((shift(attacker, noWe + north) & notHfile)) attacks |= shift(attacker, noWe + north);
+	if ((shift(attacker, noWe + west) & notHGfile)) attacks |= shift(attacker, noWe + west);
+	if ((shift(attacker, noEa + east) & notABfile)) attacks |= shift(attacker, noEa + east);
 
-	if (((attacker << soWe + south) & notHfile)) attacks |= (attacker << soWe + south);
-	if (((attacker << soEa + south) & notAfile)) attacks |= (attacker << soEa + south);
-	if (((attacker << soEa + east) & notABfile)) attacks |= (attacker << soEa + east);
-	if (((attacker << soWe + west) & notHGfile)) attacks |= (attacker << soWe + west);
+	if ((shift(attacker, soWe + south) & notHfile)) attacks |= shift(attacker, soWe + south);
+	if ((shift(attacker, soEa + south) & notAfile)) attacks |= shift(attacker, soEa + south);
+	if ((shift(attacker, soEa + east) & notABfile)) attacks |= shift(attacker, soEa + east);
+	if ((shift(attacker, soWe + west) & notHGfile)) attacks |= shift(attacker, soWe + west);
 
 	return attacks;
 }
 
-static Bitboard maskKingAttacks(int square) {
-	Bitboard attacks;
-	Bitboard attacker = Bitboard::GetSquare(square);
+static constexpr U64 maskKingAttacks(int square) {
+	U64 attacks = 0ULL;
+	U64 attacker = 1ULL << square;
 
-	attacks |= (attacker << north);
-	attacks |= (attacker << south);
-	
-	if (((attacker << west) & notHfile)) attacks |= (attacker << west);
-	if (((attacker << soWe) & notHfile)) attacks |= (attacker << soWe);
-	if (((attacker << soEa) & notAfile)) attacks |= (attacker << soEa);
-	if (((attacker << east) & notAfile)) attacks |= (attacker << east);
-	if (((attacker << noEa) & notAfile)) attacks |= (attacker << noEa);
-	if (((attacker << noWe) & notHfile)) attacks |= (attacker << noWe);
+	attacks |= shift(attacker, north);
+	attacks |= shift(attacker, south);
+
+	if ((shift(attacker, west) & notHfile)) attacks |= shift(attacker, west);
+	if ((shift(attacker, soWe) & notHfile)) attacks |= shift(attacker, soWe);
+	if ((shift(attacker, soEa) & notAfile)) attacks |= shift(attacker, soEa);
+	if ((shift(attacker, east) & notAfile)) attacks |= shift(attacker, east);
+	if ((shift(attacker, noEa) & notAfile)) attacks |= shift(attacker, noEa);
+	if ((shift(attacker, noWe) & notHfile)) attacks |= shift(attacker, noWe);
 
 	return attacks;
 }
 
-static Bitboard maskBishopAttacks(int square) {
-	Bitboard attacks;
+static constexpr U64 maskBishopAttacks(int square) {
+	U64 attacks = 0ULL;
 
 	// target rank and files
 	int tr = square / 8;
@@ -93,8 +106,8 @@ static Bitboard maskBishopAttacks(int square) {
 	return attacks;
 }
 
-static Bitboard maskRookAttacks(int square) {
-	Bitboard attacks;
+static constexpr U64 maskRookAttacks(int square) {
+	U64 attacks = 0ULL;
 
 	// target rank and files
 	int tr = square / 8;
@@ -122,14 +135,14 @@ static Bitboard maskRookAttacks(int square) {
 	return attacks;
 }
 
-static Bitboard bishopAttacksOnTheFly(int square, Bitboard block) {
-	Bitboard attacks;
+static constexpr U64 bishopAttacksOnTheFly(int square, U64 block) {
+	U64 attacks = 0ULL;
 
 	// target rank and files
 	int tr = square / 8;
 	int tf = square % 8;
 
-	Bitboard currentSquare;
+	U64 currentSquare = 0ULL;
 	
 	// generate bishop attacks
 	
@@ -161,14 +174,14 @@ static Bitboard bishopAttacksOnTheFly(int square, Bitboard block) {
 	return attacks;
 }
 
-static Bitboard rookAttacksOnTheFly(int square, Bitboard block) {
-	Bitboard attacks;
+static constexpr U64 rookAttacksOnTheFly(int square, U64 block) {
+	U64 attacks = 0ULL;
 
 	// target rank and files
 	int tr = square / 8;
 	int tf = square % 8;
 
-	Bitboard currentSquare;
+	U64 currentSquare = 0ULL;
 	
 	// generate rook attacks
 	
@@ -200,70 +213,153 @@ static Bitboard rookAttacksOnTheFly(int square, Bitboard block) {
 	return attacks;
 }
 
-void initLeaperAttacks() {
+static constexpr MultiArray<Bitboard, 2, 64> generatePawnAttacks() {
+	MultiArray<Bitboard, 2, 64> table{};
+
 	for (int square = 0; square < 64; square++) {
-		pawnAttacks[White][square] = maskPawnAttacks(White, square);
-		pawnAttacks[Black][square] = maskPawnAttacks(Black, square);
+		table[White][square] = maskPawnAttacks(White, square);
+		table[Black][square] = maskPawnAttacks(Black, square);
+	}
 
-		knightAttacks[square] = maskKnightAttacks(square);
-		kingAttacks[square] = maskKingAttacks(square);
+	return table;
+}
+
+template <U64 (*mask)(int)>
+static constexpr MultiArray<Bitboard, 64> generateLeaperAttacks() {
+	MultiArray<Bitboard, 64> table{};
+
+	for (int square = 0; square < 64; square++) {
+		table[square] = mask(square);
 	}
+
+	return table;
 }
 
-void initSliderAttacks() {
+constexpr MultiArray<Bitboard, 2, 64> pawnAttacks = generatePawnAttacks();
+constexpr MultiArray<Bitboard, 64> knightAttacks = generateLeaperAttacks<maskKnightAttacks>();
+constexpr MultiArray<Bitboard, 64> kingAttacks = generateLeaperAttacks<maskKingAttacks>();
+
+template <U64 (*mask)(int)>
+static constexpr MultiArray<U64, 64> generateMasks() {
+	MultiArray<U64, 64> table{};
+
 	for (int square = 0; square < 64; square++) {
-		bishopMasks[square] = maskBishopAttacks(square);
-		rookMasks[square] = maskRookAttacks(square);
+		table[square] = mask(square);
+	}
+
+	return table;
+}
+
+static constexpr MultiArray<U64, 64> bishopMasks = generateMasks<maskBishopAttacks>();
+static constexpr MultiArray<U64, 64> rookMasks = generateMasks<maskRookAttacks>();
 
-		for (int index = 0; index < 512; index++) {
-			Bitboard occupancy = Bitboard::getOccupancy(index, bishopMasks[square]);
+// With PEXT the index of an occupancy is its position in the enumeration, with magics it is the hashed occupancy
+template <int size>
+static constexpr MultiArray<Bitboard, 64, size> generateSliderAttacks(const MultiArray<U64, 64>& masks, const int* relevantBits,
+	[[maybe_unused]] const U64* magicNumbers, U64 (*attacksOnTheFly)(int, U64))
+{
+	MultiArray<Bitboard, 64, size> table{};
 
-			int magicIndex = (occupancy * bishopMagicNumbers[square])
-			>> (64 - bishopRelevantBits[square]);
+	for (int square = 0; square < 64; square++) {
+		// Walks every subset of the mask in increasing order, which is the order Bitboard::getOccupancy numbers them
+		U64 occupancy = 0ULL;
 
-			bishopAttacks[square][magicIndex] = bishopAttacksOnTheFly(square, occupancy);
+		for (int index = 0; index < (1 << relevantBits[square]); index++) {
+#ifdef USE_PEXT
+			U64 slot = index;
+#else
+			U64 slot = (occupancy * magicNumbers[square]) >> (64 - relevantBits[square]);
+#endif
+
+			table[square][slot] = attacksOnTheFly(square, occupancy);
+
+			occupancy = (occupancy - masks[square]) & masks[square];
 		}
+	}
+
+	return table;
+}
 
-		for (int index = 0; index < 4096; index++) {
-			Bitboard occupancy = Bitboard::getOccupancy(index, rookMasks[square]);
+static constexpr MultiArray<Bitboard, 64, 512> bishopAttacks =
+	generateSliderAttacks<512>(bishopMasks, bishopRelevantBits, bishopMagicNumbers, bishopAttacksOnTheFly);
+static constexpr MultiArray<Bitboard, 64, 4096> rookAttacks =
+	generateSliderAttacks<4096>(rookMasks, rookRelevantBits, rookMagicNumbers, rookAttacksOnTheFly);
 
-			int magicIndex = (occupancy * rookMagicNumbers[square])
-			>> (64 - rookRelevantBits[square]);
+static constexpr MultiArray<Bitboard, 64, 64> generateBetweenSquares() {
+	MultiArray<Bitboard, 64, 64> table{};
 
-			rookAttacks[square][magicIndex] = rookAttacksOnTheFly(square, occupancy);
+	for (int from = 0; from < 64; from++) {
+		for (int to = 0; to < 64; to++) {
+			if (from == to) continue;
+
+			if (rookAttacksOnTheFly(from, 0ULL) & (1ULL << to)) {
+				table[from][to] = rookAttacksOnTheFly(from, 1ULL << to) & rookAttacksOnTheFly(to, 1ULL << from);
+			} else if (bishopAttacksOnTheFly(from, 0ULL) & (1ULL << to)) {
+				table[from][to] = bishopAttacksOnTheFly(from, 1ULL << to) & bishopAttacksOnTheFly(to, 1ULL << from);
+			}
 		}
 	}
+
+	return table;
 }
 
-Bitboard getBishopAttack(int square, U64 occupancy) {
+static constexpr MultiArray<Bitboard, 64, 64> generateLineSquares() {
+	MultiArray<Bitboard, 64, 64> table{};
+
+	for (int from = 0; from < 64; from++) {
+		for (int to = 0; to < 64; to++) {
+			if (from == to) continue;
+
+			U64 ends = (1ULL << from) | (1ULL << to);
+
+			if (rookAttacksOnTheFly(from, 0ULL) & (1ULL << to)) {
+				table[from][to] = (rookAttacksOnTheFly(from, 0ULL) & rookAttacksOnTheFly(to, 0ULL)) | ends;
+			} else if (bishopAttacksOnTheFly(from, 0ULL) & (1ULL << to)) {
+				table[from][to] = (bishopAttacksOnTheFly(from, 0ULL) & bishopAttacksOnTheFly(to, 0ULL)) | ends;
+			}
+		}
+	}
+
+	return table;
+}
+
+constexpr MultiArray<Bitboard, 64, 64> betweenSquares = generateBetweenSquares();
+constexpr MultiArray<Bitboard, 64, 64> lineSquares = generateLineSquares();
+
+static inline U64 bishopIndex(int square, U64 occupancy) {
+#ifdef USE_PEXT
+	return _pext_u64(occupancy, bishopMasks[square]);
+#else
 	occupancy &= bishopMasks[square];
 	occupancy *= bishopMagicNumbers[square];
 	occupancy >>= (64 - bishopRelevantBits[square]);
 
-	return bishopAttacks[square][occupancy];
+	return occupancy;
+#endif
 }
 
-Bitboard getRookAttack(int square, U64 occupancy) {
+static inline U64 rookIndex(int square, U64 occupancy) {
+#ifdef USE_PEXT
+	return _pext_u64(occupancy, rookMasks[square]);
+#else
 	occupancy &= rookMasks[square];
 	occupancy *= rookMagicNumbers[square];
 	occupancy >>= (64 - rookRelevantBits[square]);
 
-	return rookAttacks[square][occupancy];
+	return occupancy;
+#endif
 }
 
-Bitboard getQueenAttack(int square, U64 occupancy) {
-	U64 bishopOccupancy = occupancy;
-	U64 rookOccupancy = occupancy;
-
-	bishopOccupancy &= bishopMasks[square];
-	bishopOccupancy *= bishopMagicNumbers[square];
-	bishopOccupancy >>= (64 - bishopRelevantBits[square]);
+Bitboard getBishopAttack(int square, U64 occupancy) {
+	return bishopAttacks[square][bishopIndex(square, occupancy)];
+}
 
-	rookOccupancy &= rookMasks[square];
-	rookOccupancy *= rookMagicNumbers[square];
-	rookOccupancy >>= (64 - rookRelevantBits[square]);
+Bitboard getRookAttack(int square, U64 occupancy) {
+	return rookAttacks[square][rookIndex(square, occupancy)];
+}
 
-	return rookAttacks[square][rookOccupancy] | bishopAttacks[square][bishopOccupancy];
+Bitboard getQueenAttack(int square, U64 occupancy) {
+	return rookAttacks[square][rookIndex(square, occupancy)] | bishopAttacks[square][bishopIndex(square, occupancy)];
 }
 
 Bitboard getPieceAttacks(int square, int piece, int color, U64 occupancy) {
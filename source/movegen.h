@@ -3,20 +3,50 @@
 #include "move.h"
 #include "board.h"
 
+#include "../external/multi_array.h"
+
 enum MovegenMode {
     Quiet,
     Noisy,
     All
 };
 
+// Caller owned buffer the generators write into, so every ply or picker can keep its own
+struct MoveList {
+    std::array<Move, MAX_MOVES> moves;
+    int count = 0;
+
+    void Add(Move move) {
+        moves[count++] = move;
+    }
+
+    void Clear() {
+        count = 0;
+    }
+
+    Move& operator[](int index) {
+        return moves[index];
+    }
+
+    Move* begin() {
+        return moves.data();
+    }
+
+    Move* end() {
+        return moves.data() + count;
+    }
+};
+
 namespace MOVEGEN {
 
-inline Bitboard pawnAttacks[2][64];
-inline Bitboard knightAttacks[64];
-inline Bitboard kingAttacks[64];
+// Computed at compile time in movegen.cpp
+extern const MultiArray<Bitboard, 2, 64> pawnAttacks;
+extern const MultiArray<Bitboard, 64> knightAttacks;
+extern const MultiArray<Bitboard, 64> kingAttacks;
 
-void initLeaperAttacks();
-void initSliderAttacks();
+// Squares strictly between two aligned squares, and the whole line through them. Empty when not aligned
+extern const MultiArray<Bitboard, 64, 64> betweenSquares;
+extern const MultiArray<Bitboard, 64, 64> lineSquares;
 
 Bitboard getBishopAttack(int square, U64 occupancy);
 Bitboard getRookAttack(int square, U64 occupancy);
@@ -25,20 +55,20 @@ Bitboard getPawnPushes(int square, bool color, Bitboard &occupancy);
 Bitboard getPieceAttacks(int square, int piece, int color, U64 occupancy);
 
 template <MovegenMode mode>
-void GenPawnMoves(Board &board);
+void GenPawnMoves(Board &board, MoveList &moveList, Bitboard checkMask);
 template <MovegenMode mode>
-void GenKnightMoves(Board &board);
+void GenKnightMoves(Board &board, MoveList &moveList, Bitboard checkMask);
 template <MovegenMode mode>
-void GenRookMoves(Board &board);
+void GenRookMoves(Board &board, MoveList &moveList, Bitboard checkMask);
 template <MovegenMode mode>
-void GenBishopMoves(Board &board);
+void GenBishopMoves(Board &board, MoveList &moveList, Bitboard checkMask);
 template <MovegenMode mode>
-void GenQueenMoves(Board &board);
+void GenQueenMoves(Board &board, MoveList &moveList, Bitboard checkMask);
 template <MovegenMode mode>
-void GenKingMoves(Board &board);
+void GenKingMoves(Board &board, MoveList &moveList);
 
 template <MovegenMode mode>
-void GenerateMoves(Board &board, bool clear);
+void GenerateMoves(Board &board, MoveList &moveList);
 
 void GenThreatMaps(Board &board);
 
@@ -1,13 +1,25 @@
+// Squares a piece may move to without leaving its own king in check, a pinned piece stays on its pin ray
+inline Bitboard LegalTargets(Board &board, int square, Bitboard checkMask) {
+	if (!board.pinned[board.sideToMove].IsSet(square))
+		return checkMask;
+
+	int kingSquare = (board.colors[board.sideToMove] & board.pieces[King]).getLS1BIndex();
+
+	return checkMask & lineSquares[kingSquare][square];
+}
+
 template <MovegenMode mode>
-void GenPawnMoves(Board &board) {
+void GenPawnMoves(Board &board, MoveList &moveList, Bitboard checkMask) {
 	Bitboard pawns = board.pieces[Pawn] & board.colors[board.sideToMove];
 	
 	while (pawns) {
 		int square = pawns.getLS1BIndex();
 
-		Bitboard pushes = getPawnPushes(square, board.sideToMove, board.occupied);
+		Bitboard legal = LegalTargets(board, square, checkMask);
+
+		Bitboard pushes = getPawnPushes(square, board.sideToMove, board.occupied) & legal;
 		Bitboard attacks = pawnAttacks[board.sideToMove][square];
-		Bitboard captures = attacks & board.colors[!board.sideToMove];
+		Bitboard captures = attacks & board.colors[!board.sideToMove] & legal;
 
 		Bitboard lastRank = board.sideToMove ? ranks[r_1] : ranks[r_8];
 
@@ -15,8 +27,8 @@ void GenPawnMoves(Board &board) {
 			Bitboard noisyPushes = pushes & lastRank;
 
 			if (board.enPassantTarget != noEPTarget) {
-				if (attacks.IsSet(board.enPassantTarget)) {
-					board.AddMove(Move(square, board.enPassantTarget, epCapture));
+				if (attacks.IsSet(board.enPassantTarget) && board.IsEnPassantLegal(square, board.enPassantTarget)) {
+					moveList.Add(Move(square, board.enPassantTarget, epCapture));
 				}
 			}
 
@@ -24,12 +36,12 @@ void GenPawnMoves(Board &board) {
 				int targetSquare = captures.getLS1BIndex();
 				
 				if (lastRank.IsSet(targetSquare)) {
-					board.AddMove(Move(square, targetSquare, knightPromoCapture));
-					board.AddMove(Move(square, targetSquare, bishopPromoCapture));
-					board.AddMove(Move(square, targetSquare, rookPromoCapture));
-					board.AddMove(Move(square, targetSquare, queenPromoCapture));
+					moveList.Add(Move(square, targetSquare, knightPromoCapture));
+					moveList.Add(Move(square, targetSquare, bishopPromoCapture));
+					moveList.Add(Move(square, targetSquare, rookPromoCapture));
+					moveList.Add(Move(square, targetSquare, queenPromoCapture));
 				} else {
-					board.AddMove(Move(square, targetSquare, capture));
+					moveList.Add(Move(square, targetSquare, capture));
 				}
 
 				captures.PopBit(targetSquare);
@@ -39,10 +51,10 @@ void GenPawnMoves(Board &board) {
 				int pushSquare = noisyPushes.getLS1BIndex();
 
 				// Only promotions because NOISY
-				board.AddMove(Move(square, pushSquare, knightPromotion));
-				board.AddMove(Move(square, pushSquare, bishopPromotion));
-				board.AddMove(Move(square, pushSquare, rookPromotion));
-				board.AddMove(Move(square, pushSquare, queenPromotion));
+				moveList.Add(Move(square, pushSquare, knightPromotion));
+				moveList.Add(Move(square, pushSquare, bishopPromotion));
+				moveList.Add(Move(square, pushSquare, rookPromotion));
+				moveList.Add(Move(square, pushSquare, queenPromotion));
 
 				noisyPushes.PopBit(pushSquare);
 			}
@@ -56,9 +68,9 @@ void GenPawnMoves(Board &board) {
 	
 				if (!lastRank.IsSet(pushSquare)) {
 					if (std::abs(square - pushSquare) == 16) {
-						board.AddMove(Move(square, pushSquare, doublePawnPush));
+						moveList.Add(Move(square, pushSquare, doublePawnPush));
 					} else {
-						board.AddMove(Move(square, pushSquare, quiet));
+						moveList.Add(Move(square, pushSquare, quiet));
 					}
 				}
 	
@@ -70,13 +82,13 @@ void GenPawnMoves(Board &board) {
 	}
 }
 template <MovegenMode mode>
-void GenKnightMoves(Board &board) {
+void GenKnightMoves(Board &board, MoveList &moveList, Bitboard checkMask) {
 	Bitboard knights = board.colors[board.sideToMove] & board.pieces[Knight];
 
 	while (knights) {
 		int square = knights.getLS1BIndex();
 
-		Bitboard moves = knightAttacks[square] & ~board.colors[board.sideToMove];
+		Bitboard moves = knightAttacks[square] & ~board.colors[board.sideToMove] & LegalTargets(board, square, checkMask);
 		Bitboard captures = moves & board.colors[!board.sideToMove];
 		moves &= ~captures;
 
@@ -84,7 +96,7 @@ void GenKnightMoves(Board &board) {
 			while (captures) {
 				int targetSquare = captures.getLS1BIndex();
 	
-				board.AddMove(Move(square, targetSquare, capture));
+				moveList.Add(Move(square, targetSquare, capture));
 
 				captures.PopBit(targetSquare);
 			}
@@ -96,7 +108,7 @@ void GenKnightMoves(Board &board) {
             while (moves) {
                 int targetSquare = moves.getLS1BIndex();
 
-                board.AddMove(Move(square, targetSquare, quiet));
+                moveList.Add(Move(square, targetSquare, quiet));
 
                 moves.PopBit(targetSquare);
             }
@@ -106,13 +118,13 @@ void GenKnightMoves(Board &board) {
 	}
 }
 template <MovegenMode mode>
-void GenRookMoves(Board &board) {
+void GenRookMoves(Board &board, MoveList &moveList, Bitboard checkMask) {
 	Bitboard rooks = board.colors[board.sideToMove] & board.pieces[Rook];
 
 	while (rooks) {
 		int square = rooks.getLS1BIndex();
 
-		Bitboard moves = getRookAttack(square, board.occupied) & ~board.colors[board.sideToMove];
+		Bitboard moves = getRookAttack(square, board.occupied) & ~board.colors[board.sideToMove] & LegalTargets(board, square, checkMask);
 		Bitboard captures = moves & board.colors[!board.sideToMove];
 		moves &= ~captures;
 
@@ -120,7 +132,7 @@ void GenRookMoves(Board &board) {
 			while (captures) {
 				int targetSquare = captures.getLS1BIndex();
 	
-				board.AddMove(Move(square, targetSquare, capture));
+				moveList.Add(Move(square, targetSquare, capture));
 	
 				captures.PopBit(targetSquare);
 			}
@@ -132,7 +144,7 @@ void GenRookMoves(Board &board) {
             while (moves) {
                 int targetSquare = moves.getLS1BIndex();
 
-                board.AddMove(Move(square, targetSquare, quiet));
+                moveList.Add(Move(square, targetSquare, quiet));
 
                 moves.PopBit(targetSquare);
             }
@@ -142,13 +154,13 @@ void GenRookMoves(Board &board) {
 	}
 }
 template <MovegenMode mode>
-void GenBishopMoves(Board &board) {
+void GenBishopMoves(Board &board, MoveList &moveList, Bitboard checkMask) {
 	Bitboard bishops = board.colors[board.sideToMove] & board.pieces[Bishop];
 
 	while (bishops) {
 		int square = bishops.getLS1BIndex();
 
-		Bitboard moves = getBishopAttack(square, board.occupied) & ~board.colors[board.sideToMove];
+		Bitboard moves = getBishopAttack(square, board.occupied) & ~board.colors[board.sideToMove] & LegalTargets(board, square, checkMask);
 		Bitboard captures = moves & board.colors[!board.sideToMove];
 		moves &= ~captures;
 
@@ -156,7 +168,7 @@ void GenBishopMoves(Board &board) {
 			while (captures) {
 				int targetSquare = captures.getLS1BIndex();
 	
-				board.AddMove(Move(square, targetSquare, capture));
+				moveList.Add(Move(square, targetSquare, capture));
 	
 				captures.PopBit(targetSquare);
 			}
@@ -168,7 +180,7 @@ void GenBishopMoves(Board &board) {
             while (moves) {
                 int targetSquare = moves.getLS1BIndex();
 
-                board.AddMove(Move(square, targetSquare, quiet));
+                moveList.Add(Move(square, targetSquare, quiet));
 
                 moves.PopBit(targetSquare);
             }
@@ -178,13 +190,13 @@ void GenBishopMoves(Board &board) {
 	}
 }
 template <MovegenMode mode>
-void GenQueenMoves(Board &board) {
+void GenQueenMoves(Board &board, MoveList &moveList, Bitboard checkMask) {
 	Bitboard queens = board.colors[board.sideToMove] & board.pieces[Queen];
 
 	while (queens) {
 		int square = queens.getLS1BIndex();
 
-		Bitboard moves = getQueenAttack(square, board.occupied) & ~board.colors[board.sideToMove];
+		Bitboard moves = getQueenAttack(square, board.occupied) & ~board.colors[board.sideToMove] & LegalTargets(board, square, checkMask);
 		Bitboard captures = moves & board.colors[!board.sideToMove];
 		moves &= ~captures;
 
@@ -192,7 +204,7 @@ void GenQueenMoves(Board &board) {
 			while (captures) {
 				int targetSquare = captures.getLS1BIndex();
 	
-				board.AddMove(Move(square, targetSquare, capture));
+				moveList.Add(Move(square, targetSquare, capture));
 	
 				captures.PopBit(targetSquare);
 			}
@@ -204,7 +216,7 @@ void GenQueenMoves(Board &board) {
             while (moves) {
                 int targetSquare = moves.getLS1BIndex();
 
-                board.AddMove(Move(square, targetSquare, quiet));
+                moveList.Add(Move(square, targetSquare, quiet));
 
                 moves.PopBit(targetSquare);
             }
@@ -214,10 +226,11 @@ void GenQueenMoves(Board &board) {
 	}
 }
 template <MovegenMode mode>
-void GenKingMoves(Board &board) {
+void GenKingMoves(Board &board, MoveList &moveList) {
 	int kingSquare = (board.colors[board.sideToMove] & board.pieces[King]).getLS1BIndex();
 
-	Bitboard moves = (kingAttacks[kingSquare] & ~board.colors[board.sideToMove]);
+	// The threat maps see through our king, so squares along a checking ray are excluded as well
+	Bitboard moves = (kingAttacks[kingSquare] & ~board.colors[board.sideToMove] & ~board.colorThreats[!board.sideToMove]);
 	Bitboard captures = moves & board.colors[!board.sideToMove];
 	moves &= ~board.colors[!board.sideToMove];
 
@@ -226,7 +239,7 @@ void GenKingMoves(Board &board) {
 			int square = captures.getLS1BIndex();
 	
 			Move move(kingSquare, square, capture);
-			board.AddMove(move);
+			moveList.Add(move);
 	
 			captures.PopBit(square);
 		}
@@ -236,7 +249,7 @@ void GenKingMoves(Board &board) {
         while (moves) {
             int square = moves.getLS1BIndex();
 
-            board.AddMove(Move(kingSquare, square, quiet));
+            moveList.Add(Move(kingSquare, square, quiet));
 
             moves.PopBit(square);
         }
@@ -251,7 +264,7 @@ void GenKingMoves(Board &board) {
             int targetSquare = board.sideToMove ? c8 : c1;
             if ((Bitboard(QueenSide) & board.occupied).PopCount() == 2
                     && !(mask & board.colorThreats[!board.sideToMove])) {
-                board.AddMove(Move(kingSquare, targetSquare, queenCastle));
+                moveList.Add(Move(kingSquare, targetSquare, queenCastle));
 
             }
         }
@@ -262,27 +275,34 @@ void GenKingMoves(Board &board) {
             int targetSquare = board.sideToMove ? g8 : g1;
             if ((Bitboard(KingSide) & board.occupied).PopCount() == 2
                     && !(mask & board.colorThreats[!board.sideToMove])) {
-                board.AddMove(Move(kingSquare, targetSquare, kingCastle));
+                moveList.Add(Move(kingSquare, targetSquare, kingCastle));
             }
         }
 
     }
 }
 
+// Generates legal moves only
 template <MovegenMode mode>
-void GenerateMoves(Board &board, bool clear) {
-    if (clear) {
-        board.ResetMoves();
-        board.pieceThreats = {};
-        board.colorThreats = {};
-    }
+void GenerateMoves(Board &board, MoveList &moveList) {
+    moveList.Clear();
+
+    // Non-king moves have to capture the checker or block its ray, and in double check only the king may move
+    Bitboard checkMask = ~0ULL;
 
-    GenThreatMaps(board);
+    if (board.checkers) {
+        int kingSquare = (board.colors[board.sideToMove] & board.pieces[King]).getLS1BIndex();
+        int checkerSquare = board.checkers.getLS1BIndex();
+
+        checkMask = board.checkers.PopCount() > 1
+                  ? Bitboard(0ULL)
+                  : betweenSquares[kingSquare][checkerSquare] | board.checkers;
+    }
 
-	GenPawnMoves<mode>(board);
-	GenKnightMoves<mode>(board);
-	GenKingMoves<mode>(board);
-	GenBishopMoves<mode>(board);
-	GenRookMoves<mode>(board);
-	GenQueenMoves<mode>(board);
+	GenPawnMoves<mode>(board, moveList, checkMask);
+	GenKnightMoves<mode>(board, moveList, checkMask);
+	GenKingMoves<mode>(board, moveList);
+	GenBishopMoves<mode>(board, moveList, checkMask);
+	GenRookMoves<mode>(board, moveList, checkMask);
+	GenQueenMoves<mode>(board, moveList, checkMask);
 };
@@ -7,30 +7,43 @@
 
 using namespace SEARCH;
 
+// Hands out moves one stage at a time so a cutoff early on skips the generation and scoring of the rest.
+// Noisy pickers stop after the captures, All pickers go on to the killer and the quiets
 template <MovegenMode mode>
 class MovePicker {
 private:
     enum Stage {
         TT,
-        Rest,
+        GenNoisy,
+        GoodNoisy,
+        Killer,
+        GenQuiet,
+        GoodQuiet,
+        BadNoisy,
         End
     };
 
     Board& board;
     SearchContext* ctx;
     Move ttMove;
+    Move killer;
     int ply;
     Stage stage;
 
     int index;
-    bool generated;
 
+    MoveList moves;
     int scores[MAX_MOVES];
 
+    // Captures that failed SEE while picking the good ones, tried last in the order they were found
+    MoveList badNoisy;
+    int badIndex;
+
 public:
     MovePicker(Board& b, SearchContext* c, int p, Move tt)
-        : board(b), ctx(c), ttMove(tt), ply(p), stage(TT), index(0), generated(false)
+        : board(b), ctx(c), ttMove(tt), killer(), ply(p), stage(TT), index(0), badIndex(0)
     {
+        badNoisy.Clear();
     }
 
     Move Next() {
@@ -38,34 +51,87 @@ public:
             switch (stage) {
 
                 case TT: {
-                    stage = Rest;
+                    stage = GenNoisy;
 
-                    if (ttMove && board.IsPseudoLegal(ttMove))
+                    // Generated moves are legal, moves from elsewhere have to be checked
+                    if (ttMove && board.IsPseudoLegal(ttMove) && board.IsLegal(ttMove))
                         return ttMove;
                     break;
                 }
 
-                case Rest: {
+                case GenNoisy: {
+                    MOVEGEN::GenerateMoves<Noisy>(board, moves);
+
+                    for (int i = 0; i < moves.count; i++)
+                        scores[i] = ScoreNoisy(moves[i]);
+
+                    index = 0;
+                    stage = GoodNoisy;
+                    break;
+                }
 
-                    if (!generated) {
-                        generated = true;
+                case GoodNoisy: {
+                    while (index < moves.count) {
+                        Move m = moves[FindNext()];
 
-                        MOVEGEN::GenerateMoves<mode>(board, true);
+                        if (m == ttMove)
+                            continue;
+
+                        // SEE is only paid for captures that are actually reached
+                        if (!SEE(board, m, seeOrderingThreshold)) {
+                            badNoisy.Add(m);
+                            continue;
+                        }
 
-                        ScoreAllMoves();
-                        index = 0;
+                        return m;
                     }
 
-                    while (index < board.currentMoveIndex) {
-                        int idx = FindNext();
-                        Move m  = board.moveList[idx];
+                    stage = mode == All ? Killer : BadNoisy;
+                    break;
+                }
 
-                        if (m == ttMove)
+                case Killer: {
+                    stage = GenQuiet;
+
+                    killer = ctx->killerMoves[ply];
+
+                    // Promotions were already handed out with the noisy moves
+                    if (killer && killer != ttMove && killer.IsQuiet() && board.IsPseudoLegal(killer) && board.IsLegal(killer))
+                        return killer;
+
+                    killer = Move();
+                    break;
+                }
+
+                case GenQuiet: {
+                    MOVEGEN::GenerateMoves<Quiet>(board, moves);
+
+                    for (int i = 0; i < moves.count; i++)
+                        scores[i] = ScoreQuiet(moves[i]);
+
+                    index = 0;
+                    stage = GoodQuiet;
+                    break;
+                }
+
+                case GoodQuiet: {
+                    while (index < moves.count) {
+                        Move m = moves[FindNext()];
+
+                        if (m == ttMove || m == killer)
                             continue;
 
                         return m;
                     }
 
+                    stage = BadNoisy;
+                    break;
+                }
+
+                case BadNoisy: {
+                    if (badIndex < badNoisy.count)
+                        return badNoisy[badIndex++];
+
                     stage = End;
                     break;
                 }
@@ -78,27 +144,24 @@ public:
 
 private:
 
-    int ScoreMove(Move& move) {
-
-        if (move.IsCapture()) {
+    int ScoreNoisy(Move& move) {
+        if (!move.IsCapture())
+            return 100 * move.GetPromoPiece();
 
-            int attackerType = board.GetPieceType(move.MoveFrom());
-            int targetType   = board.GetPieceType(move.MoveTo());
+        int attackerType = board.GetPieceType(move.MoveFrom());
+        int targetType   = board.GetPieceType(move.MoveTo());
 
-            if (move.GetFlags() == epCapture)
-                targetType = Pawn;
+        if (move.GetFlags() == epCapture)
+            targetType = Pawn;
 
-            int capthistScore =
-                ctx->capthist[board.sideToMove][attackerType][targetType][move.MoveTo()];
-
-            return 50000 * SEE(board, move, seeOrderingThreshold)
-                 + (100 * targetType - attackerType + 105)
-                 + capthistScore;
-        }
+        int capthistScore =
+            ctx->capthist[board.sideToMove][attackerType][targetType][move.MoveTo()];
 
-        if (ctx->killerMoves[ply] == move)
-            return 41000;
+        return (100 * targetType - attackerType + 105)
+             + capthistScore;
+    }
 
+    int ScoreQuiet(Move& move) {
         bool sourceThreatened = board.IsSquareThreatened(board.sideToMove, move.MoveFrom());
         bool targetThreatened = board.IsSquareThreatened(board.sideToMove, move.MoveTo());
 
@@ -118,13 +181,7 @@ private:
                 conthistScore += ctx->conthist.GetNPly(board, move, ctx, ply, 2);
         }
 
-        return 20000 + historyScore + conthistScore;
-    }
-
-    void ScoreAllMoves() {
-        int moveCount = board.currentMoveIndex;
-        for (int i = 0; i < moveCount; i++)
-            scores[i] = ScoreMove(board.moveList[i]);
+        return historyScore + conthistScore;
     }
 
     int FindNext() {
@@ -134,10 +191,8 @@ private:
             return static_cast<uint64_t>(widened) << 32;
         };
 
-        int moveCount = board.currentMoveIndex;
-
         uint64_t best = toU64(scores[index]) | static_cast<uint64_t>(256 - index);
-        for (int i = index + 1; i < moveCount; i++) {
+        for (int i = index + 1; i < moves.count; i++) {
             uint64_t curr = toU64(scores[i]) | static_cast<uint64_t>(256 - i);
             if (curr > best)
                 best = curr;
@@ -146,10 +201,10 @@ private:
         int bestIdx = 256 - static_cast<int>(best & 0xFFFFFFFF);
 
         if (bestIdx != index) {
-            std::swap(board.moveList[index], board.moveList[bestIdx]);
-            std::swap(scores[index],         scores[bestIdx]);
+            std::swap(moves[index], moves[bestIdx]);
+            std::swap(scores[index], scores[bestIdx]);
         }
 
         return index++;
     }
-};
\ No newline at end of file
+};
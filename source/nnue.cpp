@@ -1,146 +1,534 @@
 #include <fstream>
+#include <iostream>
 #include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#ifndef _WIN32
+    #include <atomic>
+    #include <cerrno>
+    #include <chrono>
+    #include <cstdio>
+    #include <thread>
+    #include <fcntl.h>
+    #include <sys/file.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
 
 #include "nnue.h"
 #include "accumulator.h"
 #include "board.h"
 #include "types.h"
 #include "search.h"
+#include "simd.h"
+#include "memory.h"
 
 namespace NNUE {
 
-void Network::Load(const std::string& path) {
-    std::ifstream file(path, std::ios::binary);
-    if (!file.is_open()){
-        std::cerr << "Failed to open file " + path << std::endl;
-    }
+static bool HasHeader(const unsigned char* data, size_t size) {
+    return size >= sizeof(NetworkHeader) && std::memcmp(data, NETWORK_MAGIC, sizeof(NETWORK_MAGIC)) == 0;
+}
+
+// Returns the start of the weights, or nullptr if the data does not fit this build.
+// The checksum is left to VerifyChecksum, so a network that is already shared is not read in full
+static const unsigned char* ValidateLayout(const unsigned char* data, size_t size, const std::string& name) {
+    if (HasHeader(data, size)) {
+        NetworkHeader header;
+        std::memcpy(&header, data, sizeof(header));
+
+        if (header.version != NETWORK_VERSION) {
+            std::cerr << "Unsupported network version " << header.version << " in " << name << std::endl;
+            return nullptr;
+        }
+
+        if (header.archHash != ARCH_HASH) {
+            std::cerr << "Network " << name << " was trained for a different architecture" << std::endl;
+            return nullptr;
+        }
 
-    // HL weights
-    for (size_t i = 0; i < accumulator_weights.size(); i++) {
-        for (size_t j = 0; j < accumulator_weights[i].size(); j++) {
-            file.read(reinterpret_cast<char*>(&accumulator_weights[i][j]), sizeof(int16_t));
+        if (size != sizeof(NetworkHeader) + NETWORK_BYTES) {
+            std::cerr << "Network " << name << " has " << size - sizeof(NetworkHeader)
+                << " bytes of weights, expected " << NETWORK_BYTES << std::endl;
+            return nullptr;
         }
+
+        return data + sizeof(NetworkHeader);
     }
 
-    // HL biases
-    for (size_t i = 0; i < accumulator_biases.size(); i++) {
-        file.read(reinterpret_cast<char*>(&accumulator_biases[i]), sizeof(int16_t));
+    // Raw weights without a header can only be checked by size
+    if (size != NETWORK_BYTES) {
+        std::cerr << "Network " << name << " has " << size << " bytes, expected " << NETWORK_BYTES << std::endl;
+        return nullptr;
     }
 
-    // Output weights
-    for (size_t i = 0; i < output_weights.size(); i++) {
-        for (size_t j = 0; j < output_weights[i].size(); j++) {
-            file.read(reinterpret_cast<char*>(&output_weights[i][j]), sizeof(int16_t));
-        }
+    return data;
+}
+
+// Expects data that passed ValidateLayout. Raw weights have no checksum to compare against
+static bool VerifyChecksum(const unsigned char* data, size_t size, const std::string& name) {
+    if (!HasHeader(data, size))
+        return true;
+
+    NetworkHeader header;
+    std::memcpy(&header, data, sizeof(header));
+
+    if (Checksum(data + sizeof(NetworkHeader), NETWORK_BYTES) != header.checksum) {
+        std::cerr << "Checksum mismatch in network " << name << std::endl;
+        return false;
     }
 
-    // Output biases
-    for (size_t i = 0; i < output_bias.size(); i++) {
-        file.read(reinterpret_cast<char*>(&output_bias[i]), sizeof(int16_t));
-    }
-}
-
-#if defined(__x86_64__) || defined(__amd64__) || (defined(_WIN64) && (defined(_M_X64) || defined(_M_AMD64)))
-#include <immintrin.h>
-#if defined(__AVX512F__)
-#pragma message("Using AVX512 NNUE inference")
-using nativeVector = __m512i;
-#define set1_epi16 _mm512_set1_epi16
-#define load_epi16 _mm512_load_si512
-#define min_epi16 _mm512_min_epi16
-#define max_epi16 _mm512_max_epi16
-#define madd_epi16 _mm512_madd_epi16
-#define mullo_epi16 _mm512_mullo_epi16
-#define add_epi32 _mm512_add_epi32
-#define reduce_epi32 _mm512_reduce_add_epi32
-#elif defined(__AVX2__)
-#pragma message("Using AVX2 NNUE inference")
-using nativeVector = __m256i;
-#define set1_epi16 _mm256_set1_epi16
-#define load_epi16 _mm256_load_si256
-#define min_epi16 _mm256_min_epi16
-#define max_epi16 _mm256_max_epi16
-#define madd_epi16 _mm256_madd_epi16
-#define mullo_epi16 _mm256_mullo_epi16
-#define add_epi32 _mm256_add_epi32
-#define reduce_epi32 \
-    [](nativeVector vec) { \
-        __m128i xmm1 = _mm256_extracti128_si256(vec, 1); \
-        __m128i xmm0 = _mm256_castsi256_si128(vec); \
-        xmm0         = _mm_add_epi32(xmm0, xmm1); \
-        xmm1         = _mm_shuffle_epi32(xmm0, 238); \
-        xmm0         = _mm_add_epi32(xmm0, xmm1); \
-        xmm1         = _mm_shuffle_epi32(xmm0, 85); \
-        xmm0         = _mm_add_epi32(xmm0, xmm1); \
-        return _mm_cvtsi128_si32(xmm0); \
+    return true;
+}
+
+static const unsigned char* embeddedData = nullptr;
+static size_t embeddedSize = 0;
+
+// Memory backing the active network when it was loaded from a file or a shared segment
+struct NetworkStorage {
+    unsigned char* data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+
+    MEMORY::LargeAllocation large;
+
+    // Open while a shared segment is mapped, it carries the lock that keeps the segment alive
+    int sharedFd = -1;
+    std::string sharedName;
+
+    void Release();
+};
+
+static NetworkStorage storage;
+
+void SetEmbeddedNetwork(const unsigned char* data, size_t size) {
+    embeddedData = data;
+    embeddedSize = size;
+
+    LoadNetwork(std::string(EMBEDDED_NETWORK));
+}
+
+// Reads the whole file with a single call into aligned memory
+static bool ReadNetworkFile(const std::string& path, NetworkStorage& out) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file " + path << std::endl;
+        return false;
     }
-#else
-#pragma message("Using SSE NNUE inference")
-using nativeVector = __m128i;
-#define set1_epi16 _mm_set1_epi16
-#define load_epi16 _mm_load_si128
-#define min_epi16 _mm_min_epi16
-#define max_epi16 _mm_max_epi16
-#define madd_epi16 _mm_madd_epi16
-#define mullo_epi16 _mm_mullo_epi16
-#define add_epi32 _mm_add_epi32
-#define reduce_epi32 \
-    [](nativeVector vec) { \
-        __m128i xmm1 = _mm_shuffle_epi32(vec, 238); \
-        vec          = _mm_add_epi32(vec, xmm1); \
-        xmm1         = _mm_shuffle_epi32(vec, 85); \
-        vec          = _mm_add_epi32(vec, xmm1); \
-        return _mm_cvtsi128_si32(vec); \
+
+    const size_t size = file.tellg();
+    file.seekg(0);
+
+    out.large = MEMORY::AllocateLarge(size);
+    out.data = static_cast<unsigned char*>(out.large.data);
+    out.size = size;
+    out.mapped = false;
+
+    if (!out.data) {
+        std::cerr << "Failed to allocate memory for " + path << std::endl;
+        return false;
+    }
+
+    if (!file.read(reinterpret_cast<char*>(out.data), size)) {
+        std::cerr << "Failed to read file " + path << std::endl;
+        out.Release();
+        return false;
     }
-#endif
 
-#elif defined(__aarch64__)
-#pragma message("Using ARM64 (NEON) NNUE inference")
-#include <arm_neon.h>
-using nativeVector = int16x8_t;
-static inline nativeVector set1_epi16(int16_t v) {
-    return vdupq_n_s16(v);
+    return true;
 }
-static inline nativeVector load_epi16(const nativeVector* ptr) {
-    return *ptr;
+
+#ifndef _WIN32
+static bool MapNetworkFile(const std::string& path, NetworkStorage& out) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        std::cerr << "Failed to open file " + path << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        std::cerr << "Failed to stat file " + path << std::endl;
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return ReadNetworkFile(path, out);
+    }
+
+    out.data = static_cast<unsigned char*>(data);
+    out.size = st.st_size;
+    out.mapped = true;
+
+    return true;
 }
-static inline nativeVector min_epi16(nativeVector a, nativeVector b) {
-    return vminq_s16(a, b);
+#endif
+
+#ifndef _WIN32
+// Start of a shared network segment, the weights follow it
+struct SharedSegmentHeader {
+    std::atomic<uint32_t> ready;
+    char padding[ALIGNMENT - sizeof(std::atomic<uint32_t>)];
+};
+
+static_assert(sizeof(SharedSegmentHeader) == ALIGNMENT, "Shared segment header must keep the weights aligned");
+
+constexpr size_t SEGMENT_BYTES = sizeof(SharedSegmentHeader) + NETWORK_BYTES;
+
+// Names the segment without reading the weights: the header checksum if there is one, plus the identity
+// of the file they came from. Raw embedded weights are only checksummed when the binary cannot be found
+static uint64_t NetworkIdentity(const unsigned char* data, size_t size, const std::string& path) {
+    uint64_t id = HashCombine(ARCH_HASH, size);
+
+    if (HasHeader(data, size)) {
+        NetworkHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        id = HashCombine(id, header.checksum);
+    }
+
+    struct stat st;
+    const std::string source = path == EMBEDDED_NETWORK ? "/proc/self/exe" : path;
+
+    if (stat(source.c_str(), &st) == 0) {
+        for (uint64_t value : {uint64_t(st.st_dev), uint64_t(st.st_ino), uint64_t(st.st_size), uint64_t(st.st_mtime)})
+            id = HashCombine(id, value);
+    } else if (!HasHeader(data, size)) {
+        id = HashCombine(id, Checksum(data, size));
+    }
+
+    return id;
 }
-static inline nativeVector max_epi16(nativeVector a, nativeVector b) {
-    return vmaxq_s16(a, b);
+
+// Removes the name only if it still refers to the segment behind fd, not to one created after it
+static void UnlinkSegment(int fd, const std::string& name) {
+    struct stat ours, named;
+    const int namedFd = shm_open(name.c_str(), O_RDONLY, 0);
+
+    if (namedFd == -1)
+        return;
+
+    if (fstat(fd, &ours) == 0 && fstat(namedFd, &named) == 0
+        && ours.st_dev == named.st_dev && ours.st_ino == named.st_ino) {
+        shm_unlink(name.c_str());
+    }
+
+    close(namedFd);
 }
-static inline int32x4_t madd_epi16(nativeVector a, nativeVector b) {
-    int32x4_t lo = vmull_s16(vget_low_s16(a), vget_low_s16(b));
-    int32x4_t hi = vmull_s16(vget_high_s16(a), vget_high_s16(b));
-    int32x4_t sum_lo = vpaddq_s32(lo, lo);
-    int32x4_t sum_hi = vpaddq_s32(hi, hi);
-    return vcombine_s32(vget_low_s32(sum_lo), vget_low_s32(sum_hi));
+
+// Every process using a segment holds a shared flock on it, and its creator holds an exclusive one until
+// the weights are in. Only the last process to let go can take the exclusive lock, and it removes the name
+static void ReleaseSharedSegment(int fd, const std::string& name) {
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+        UnlinkSegment(fd, name);
+
+    close(fd);
 }
-static inline nativeVector mullo_epi16(nativeVector a, nativeVector b) {
-    return vmulq_s16(a, b);
+
+// Maps a segment another process created once it holds the weights. A segment whose creator died
+// before filling it is removed, so the caller can create it again
+static bool AttachSharedNetwork(const std::string& name, NetworkStorage& out) {
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        return false;
+
+    // Blocks while the creator copies the weights in, a crashed creator has released its lock
+    struct stat st;
+    for (int i = 0; ; i++) {
+        flock(fd, LOCK_SH);
+
+        if (fstat(fd, &st) == 0 && st.st_size != 0)
+            break;
+
+        // An empty segment is either still being set up by its creator or was left by one that died
+        if (i == 100) {
+            if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+                UnlinkSegment(fd, name);
+
+            close(fd);
+            return false;
+        }
+
+        flock(fd, LOCK_UN);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    void* data = static_cast<size_t>(st.st_size) == SEGMENT_BYTES
+        ? mmap(nullptr, SEGMENT_BYTES, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+    // The creator sizes the segment only after locking it, so holding the lock and not seeing it ready
+    // means the creator is gone
+    if (data == MAP_FAILED || !static_cast<const SharedSegmentHeader*>(data)->ready.load(std::memory_order_acquire)) {
+        std::cerr << "Removing stale shared memory segment " << name << std::endl;
+
+        if (data != MAP_FAILED)
+            munmap(data, SEGMENT_BYTES);
+
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+            UnlinkSegment(fd, name);
+
+        close(fd);
+        return false;
+    }
+
+    out.data = static_cast<unsigned char*>(data);
+    out.size = SEGMENT_BYTES;
+    out.mapped = true;
+    out.sharedFd = fd;
+    out.sharedName = name;
+    return true;
 }
-static inline int32x4_t add_epi32(int32x4_t a, int32x4_t b) {
-    return vaddq_s32(a, b);
+
+// Creates the named segment and copies the weights in. exists is set when another process got there first
+static bool CreateSharedNetwork(const std::string& name, const unsigned char* weights, NetworkStorage& out, bool& exists) {
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    exists = fd == -1 && errno == EEXIST;
+
+    if (fd == -1) {
+        if (!exists)
+            std::cerr << "Failed to open shared memory segment " << name << std::endl;
+        return false;
+    }
+
+    const auto fail = [&](const char* message) {
+        std::cerr << message << " shared memory segment " << name << std::endl;
+        shm_unlink(name.c_str());
+        close(fd);
+        return false;
+    };
+
+    flock(fd, LOCK_EX);
+
+    if (ftruncate(fd, SEGMENT_BYTES) == -1)
+        return fail("Failed to size");
+
+    void* data = mmap(nullptr, SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (data == MAP_FAILED)
+        return fail("Failed to map");
+
+#ifdef MADV_HUGEPAGE
+    madvise(data, SEGMENT_BYTES, MADV_HUGEPAGE);
+#endif
+
+    std::memcpy(static_cast<unsigned char*>(data) + sizeof(SharedSegmentHeader), weights, NETWORK_BYTES);
+    static_cast<SharedSegmentHeader*>(data)->ready.store(1, std::memory_order_release);
+    mprotect(data, SEGMENT_BYTES, PROT_READ);
+
+    flock(fd, LOCK_SH);
+
+    out.data = static_cast<unsigned char*>(data);
+    out.size = SEGMENT_BYTES;
+    out.mapped = true;
+    out.sharedFd = fd;
+    out.sharedName = name;
+    return true;
 }
-static inline int reduce_epi32(int32x4_t v) {
-    int32x2_t pair = vadd_s32(vget_low_s32(v), vget_high_s32(v));
-    int32x2_t total = vpadd_s32(pair, pair);
-    return vget_lane_s32(total, 0);
+#endif
+
+void NetworkStorage::Release() {
+    if (large.data) {
+        MEMORY::FreeLarge(large);
+    }
+#ifndef _WIN32
+    else if (mapped) {
+        munmap(data, size);
+    }
+
+    if (sharedFd != -1) {
+        ReleaseSharedSegment(sharedFd, sharedName);
+    }
+#endif
+
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    sharedFd = -1;
+    sharedName.clear();
 }
 
+// Zero-copy weights are gathered from all over 18 MB, so on 4 KB pages nearly every accumulator update misses
+// the TLB. Asks for huge pages on the 2 MB aligned part of them. For the executable or a mapped EvalFile,
+// both backed by a file, this only takes effect on kernels that collapse read-only file pages
+static bool AdviseHugePages(const unsigned char* weights) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    constexpr uintptr_t HUGE_PAGE = 2 * 1024 * 1024;
+
+    const uintptr_t begin = (reinterpret_cast<uintptr_t>(weights) + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    const uintptr_t end = (reinterpret_cast<uintptr_t>(weights) + NETWORK_BYTES) & ~(HUGE_PAGE - 1);
+
+    return end > begin && madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE) == 0;
 #else
-#pragma message("Using fallback scalar NNUE inference")
-using nativeVector = void*;
+    (void)weights;
+    return false;
 #endif
+}
+
+// Opt-in copy of the weights into huge pages, for when the TLB matters more than private memory
+static const unsigned char* CopyToLargePages(const unsigned char* weights, NetworkStorage& loaded) {
+    if (loaded.large.data)
+        return weights;
 
+    MEMORY::LargeAllocation large = MEMORY::AllocateLarge(NETWORK_BYTES);
 
-static int32_t VectorizedSCReLU(const Board& board, const Network& net, size_t outputBucket) {
-    const size_t VECTOR_SIZE = sizeof(nativeVector) / sizeof(int16_t);
+    if (!large.data || large.backing == MEMORY::Backing::Regular) {
+        MEMORY::FreeLarge(large);
+        return weights;
+    }
+
+    std::memcpy(large.data, weights, NETWORK_BYTES);
+
+    loaded.Release();
+    loaded.large = large;
+    loaded.data = static_cast<unsigned char*>(large.data);
+    loaded.size = NETWORK_BYTES;
+
+    return loaded.data;
+}
+
+static std::string networkBacking = "none";
+
+static bool shareNetworks = false;
+static bool copyToLargePages = false;
+static std::string activeNetwork = std::string(EMBEDDED_NETWORK);
+
+bool LoadNetwork(const std::string& path) {
+    NetworkStorage loaded;
+    const unsigned char* source = nullptr;
+    size_t sourceSize = 0;
+
+    if (path == EMBEDDED_NETWORK) {
+        if (!embeddedData) {
+            std::cerr << "No network was embedded into this build" << std::endl;
+            return false;
+        }
+
+        source = embeddedData;
+        sourceSize = embeddedSize;
+    } else {
+    #ifndef _WIN32
+        const bool opened = MapNetworkFile(path, loaded);
+    #else
+        const bool opened = ReadNetworkFile(path, loaded);
+    #endif
+
+        if (!opened)
+            return false;
+
+        source = loaded.data;
+        sourceSize = loaded.size;
+    }
+
+    const unsigned char* weights = ValidateLayout(source, sourceSize, path);
+    if (!weights) {
+        loaded.Release();
+        return false;
+    }
+
+    if (path == EMBEDDED_NETWORK && reinterpret_cast<uintptr_t>(weights) % ALIGNMENT != 0) {
+        std::cerr << "Embedded network is not aligned to " << ALIGNMENT << " bytes" << std::endl;
+        return false;
+    }
+
+    bool shared = false;
+    bool verified = false;
+
+    // An existing segment was checked by its creator. Falls back to the private copy if no segment can be used
+    if (shareNetworks) {
+    #ifndef _WIN32
+        char name[64];
+        std::snprintf(name, sizeof(name), "/eleanor-nnue-%016llx",
+            static_cast<unsigned long long>(NetworkIdentity(source, sourceSize, path)));
+
+        NetworkStorage segment;
+        shared = AttachSharedNetwork(name, segment);
+
+        if (!shared) {
+            if (!VerifyChecksum(source, sourceSize, path)) {
+                loaded.Release();
+                return false;
+            }
+
+            verified = true;
+
+            bool exists = false;
+            shared = CreateSharedNetwork(name, weights, segment, exists)
+                || (exists && AttachSharedNetwork(name, segment));
+        }
+
+        if (shared) {
+            loaded.Release();
+            loaded = segment;
+            weights = segment.data + sizeof(SharedSegmentHeader);
+
+            // Lets the last process using the segment remove it on a normal exit
+            static const bool releaseAtExit = std::atexit([] { storage.Release(); }) == 0;
+            (void)releaseAtExit;
+        }
+    #else
+        std::cerr << "Shared networks are not supported on this platform" << std::endl;
+    #endif
+    }
+
+    if (!shared && !verified && !VerifyChecksum(source, sourceSize, path)) {
+        loaded.Release();
+        return false;
+    }
+
+    if (!shared && copyToLargePages) {
+        weights = CopyToLargePages(weights, loaded);
+    }
+
+    if (shared) {
+        networkBacking = "shared memory segment";
+    } else if (loaded.large.data) {
+        networkBacking = MEMORY::BackingName(loaded.large.backing);
+    } else {
+        networkBacking = loaded.mapped ? "mapped file on regular pages" : "embedded data on regular pages";
+
+        if (AdviseHugePages(weights))
+            networkBacking += ", huge pages advised";
+    }
+
+    net = reinterpret_cast<const Network*>(weights);
+    storage.Release();
+    storage = loaded;
+    activeNetwork = path;
+
+    return true;
+}
+
+std::string_view NetworkBacking() {
+    return networkBacking;
+}
+
+bool SetSharedNetwork(bool enabled) {
+    if (enabled == shareNetworks)
+        return true;
+
+    shareNetworks = enabled;
+    return LoadNetwork(activeNetwork);
+}
+
+bool SetNetworkLargePages(bool enabled) {
+    if (enabled == copyToLargePages)
+        return true;
+
+    copyToLargePages = enabled;
+    return LoadNetwork(activeNetwork);
+}
+
+#pragma message("Using " SIMD_BACKEND " NNUE inference")
+
+static int32_t VectorizedSCReLU(const Board& board, const ACC::AccumulatorPair& accPair, const Network& net, size_t outputBucket) {
     static_assert(HL_SIZE % VECTOR_SIZE == 0, "HL size must be divisible by the native register size of your CPU for vectorization to work");
 
-    const ACC::Accumulator& stmAcc = board.sideToMove == White ? board.accPair.white : board.accPair.black;
-    const ACC::Accumulator& nstmAcc = !board.sideToMove == White ? board.accPair.white : board.accPair.black;
+    const ACC::Accumulator& stmAcc = board.sideToMove == White ? accPair.white : accPair.black;
+    const ACC::Accumulator& nstmAcc = !board.sideToMove == White ? accPair.white : accPair.black;
 
     const nativeVector VEC_QA   = set1_epi16(QA);
     const nativeVector VEC_ZERO = set1_epi16(0);
@@ -171,13 +559,13 @@ static int32_t VectorizedSCReLU(const Board& board, const Network& net, size_t o
     return reduce_epi32(accumulator);
 }
 
-int Forward(const Board& board, const Network& net) {
+int Forward(const Board& board, const ACC::AccumulatorPair& accPair, const Network& net) {
     const size_t divisor      = 32 / OUTPUT_BUCKETS;
     const size_t outputBucket = (board.occupied.PopCount() - 2) / divisor;
 
     int64_t eval = 0;
 
-    eval = VectorizedSCReLU(board, net, outputBucket);
+    eval = VectorizedSCReLU(board, accPair, net, outputBucket);
 
     eval /= QA;
 
@@ -187,7 +575,7 @@ int Forward(const Board& board, const Network& net) {
     return (eval * SCALE) / (QA * QB);
 }
 
-int16_t Network::Evaluate(const Board& board, bool datagen) {
+int16_t Network::Evaluate(const Board& board, const ACC::AccumulatorPair& accPair, bool datagen) const {
     // Disabled in datagen
     const int materialScale = datagen ? 4096 : 2048
         +  90 * board.pieces[Knight].PopCount()
@@ -195,8 +583,15 @@ int16_t Network::Evaluate(const Board& board, bool datagen) {
         + 180 * board.pieces[Rook].PopCount()
         + 360 * board.pieces[Queen].PopCount();
 
-    return std::clamp(Forward(board, *this) * materialScale / 4096, (-SEARCH::MATE_SCORE + SEARCH::MAX_DEPTH),
+    return std::clamp(Forward(board, accPair, *this) * materialScale / 4096, (-SEARCH::MATE_SCORE + SEARCH::MAX_DEPTH),
         (SEARCH::MATE_SCORE - SEARCH::MAX_DEPTH));
 }
 
+int16_t Network::Evaluate(const Board& board, bool datagen) const {
+    ACC::AccumulatorPair accPair;
+    accPair.Refresh(board);
+
+    return Evaluate(board, accPair, datagen);
+}
+
 }
@@ -1,10 +1,17 @@
 #pragma once
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <array>
 
 class Board;
 
+namespace ACC {
+struct AccumulatorPair;
+}
+
 #ifdef __AVX512F__
 constexpr size_t ALIGNMENT = 64;
 #else
@@ -52,11 +59,100 @@ struct Network {
     alignas(ALIGNMENT) std::array<std::array<int16_t, 2 * HL_SIZE>, OUTPUT_BUCKETS> output_weights;
     std::array<int16_t, OUTPUT_BUCKETS> output_bias;
 
-    void Load(const std::string& path);
+    int16_t Evaluate(const Board& board, const ACC::AccumulatorPair& accPair, bool datagen = false) const;
+
+    // Builds the accumulators from scratch, for callers outside of the search
+    int16_t Evaluate(const Board& board, bool datagen = false) const;
+};
+
+// Size of the weights in a network file, without the struct's tail padding
+constexpr size_t NETWORK_BYTES = offsetof(Network, output_bias) + sizeof(Network::output_bias);
 
-    int16_t Evaluate(const Board& board, bool datagen = false);
+// Header in front of the weights, validated against the compiled architecture. The embedded network always
+// has one, files without it are still accepted but only checked by size
+struct NetworkHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t archHash;
+    uint64_t checksum;
+    char padding[40];
 };
 
-inline Network net;
+static_assert(sizeof(NetworkHeader) % ALIGNMENT == 0, "Network header must keep the weights aligned");
+
+constexpr char NETWORK_MAGIC[4] = {'E', 'L', 'N', 'R'};
+constexpr uint32_t NETWORK_VERSION = 1;
+
+constexpr uint64_t HashCombine(uint64_t hash, uint64_t value) {
+    return (hash ^ value) * 0x100000001B3ULL;
+}
+
+// Identifies the layout a network file has to be trained for
+constexpr uint64_t ArchitectureHash() {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for (uint64_t value : {INPUT_SIZE, HL_SIZE, INPUT_BUCKETS, OUTPUT_BUCKETS,
+        uint64_t(SCALE), uint64_t(QA), uint64_t(QB)}) {
+        hash = HashCombine(hash, value);
+    }
+
+    for (const auto& side : kingBuckets) {
+        for (int bucket : side)
+            hash = HashCombine(hash, bucket);
+    }
+
+    return hash;
+}
+
+constexpr uint64_t ARCH_HASH = ArchitectureHash();
+
+inline uint64_t Checksum(const unsigned char* data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = HashCombine(hash, word);
+    }
+
+    for (; i < size; i++)
+        hash = HashCombine(hash, data[i]);
+
+    return hash;
+}
+
+// Header for NETWORK_BYTES of raw weights, written in front of them by Scripts/makenet.cpp
+inline NetworkHeader MakeNetworkHeader(const unsigned char* weights) {
+    NetworkHeader header{};
+
+    std::memcpy(header.magic, NETWORK_MAGIC, sizeof(header.magic));
+    header.version = NETWORK_VERSION;
+    header.archHash = ARCH_HASH;
+    header.checksum = Checksum(weights, NETWORK_BYTES);
+
+    return header;
+}
+
+constexpr std::string_view EMBEDDED_NETWORK = "<embedded>";
+
+// Active network. Points straight into the embedded data, the mapped file or the shared segment.
+// It is only copied into private memory, backed by large pages when available, for a file that cannot be
+// mapped or when SetNetworkLargePages asks for it
+inline const Network* net = nullptr;
+
+void SetEmbeddedNetwork(const unsigned char* data, size_t size);
+
+// Accepts a path or EMBEDDED_NETWORK. On failure the previous network stays active
+bool LoadNetwork(const std::string& path);
+
+// Keeps the active network in a named shared memory segment so processes using the same weights
+// map a single read-only copy. Not supported on Windows
+bool SetSharedNetwork(bool enabled);
+
+// Copies zero-copy weights into huge pages once per load. Costs a private copy of the network per process
+bool SetNetworkLargePages(bool enabled);
+
+std::string_view NetworkBacking();
 
 }
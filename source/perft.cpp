@@ -1,46 +1,100 @@
 #include "perft.h"
 #include "stopwatch.h"
 #include "movegen.h"
-#include <cassert>
-
-static U64 HelperPerft(Board &board, int depth) {
-    MOVEGEN::GenerateMoves<All>(board, true);
-
-    if (depth == 0) return 1ULL;
+#include <thread>
+#include <vector>
+#include <memory>
+#include <algorithm>
 
+// Moves are made and unmade on the one board, states holds the undo information for each remaining depth.
+// At depth 1 the legal moves are counted instead of made
+static U64 HelperPerft(Board &board, int depth, PerftTable* table, BoardState* states) {
     U64 nodes = 0;
 
-    for (int i = 0; i < board.currentMoveIndex; i++) {
-        if (!board.IsLegal(board.moveList[i])) continue;
+    if (depth > 1 && table && table->Probe(board.hashKey, depth, nodes))
+        return nodes;
 
-        Board copy = board;
-        copy.MakeMove(board.moveList[i]);
+    MoveList moveList;
+    MOVEGEN::GenerateMoves<All>(board, moveList);
 
-        nodes += HelperPerft(copy, depth - 1);
+    if (depth == 1)
+        return moveList.count;
+
+    for (Move move : moveList) {
+        board.MakeMove(move, states[depth]);
+        nodes += HelperPerft(board, depth - 1, table, states);
+        board.UnmakeMove(move, states[depth]);
     }
+
+    if (table)
+        table->Store(board.hashKey, depth, nodes);
+
     return nodes;
 }
 
-void Perft(Board &board, int depth) {
-    //board.SetByFen(StartingFen);
-    MOVEGEN::GenerateMoves<All>(board, true);
+U64 Perft(Board &board, int depth, int threads, int hashMB, bool print) {
+    std::unique_ptr<PerftTable> table;
+    if (hashMB > 0 && depth > 2)
+        table = std::make_unique<PerftTable>(hashMB);
 
-    U64 totalNodes = 0;
+    return Perft(board, depth, threads, table.get(), print);
+}
 
+U64 Perft(Board &board, int depth, int threads, PerftTable* table, bool print) {
     Stopwatch sw;
-    for (int i = 0; i < board.currentMoveIndex; i++) {
-        if (!board.IsLegal(board.moveList[i])) continue;
+
+    MoveList moveList;
+    MOVEGEN::GenerateMoves<All>(board, moveList);
+
+    threads = std::clamp(threads, 1, std::max(moveList.count, 1));
+
+    // Each thread takes the next unclaimed root move until none are left
+    std::vector<U64> moveNodes(moveList.count, 0);
+    std::atomic<int> nextMove = 0;
+
+    auto worker = [&]() {
         Board copy = board;
-        copy.MakeMove(board.moveList[i]);
-        U64 nodeCount = HelperPerft(copy, depth - 1);
-        totalNodes += nodeCount;
-        board.moveList[i].PrintMove();
+        std::vector<BoardState> states(std::max(depth, 1) + 1);
+
+        for (int i = nextMove++; i < moveList.count; i = nextMove++) {
+            copy.MakeMove(moveList[i], states[depth]);
+            moveNodes[i] = depth > 1 ? HelperPerft(copy, depth - 1, table, states.data()) : 1;
+            copy.UnmakeMove(moveList[i], states[depth]);
+        }
+    };
+
+    U64 totalNodes = 0;
+
+    if (depth == 0) {
+        totalNodes = 1;
+    } else {
+        std::vector<std::thread> workers;
+        workers.reserve(threads - 1);
+
+        for (int id = 1; id < threads; id++)
+            workers.emplace_back(worker);
+
+        worker();
+
+        for (auto& thread : workers)
+            thread.join();
+    }
+
+    for (int i = 0; i < moveList.count && depth > 0; i++) {
+        totalNodes += moveNodes[i];
+
+        if (print) {
+            moveList[i].PrintMove();
+            std::cout << ": " << moveNodes[i] << std::endl;
+        }
+    }
 
-        std::cout << ": " << nodeCount << std::endl;
+    if (print) {
+        std::cout << std::endl << "Depth: " << depth << std::endl;
+        std::cout << "Total nodes: " << totalNodes << std::endl;
+        std::cout << "Time took: " << sw.GetElapsedSec() << "s (";
+        std::cout << U64(totalNodes / sw.GetElapsedSec()) << " nodes/sec)" << std::endl;
     }
 
-    std::cout << std::endl << "Depth: " << depth << std::endl;
-    std::cout << "Total nodes: " << totalNodes << std::endl;
-    std::cout << "Time took: " << sw.GetElapsedSec() << "s (";
-    std::cout << int(totalNodes / sw.GetElapsedSec()) << " nodes/sec)" << std::endl;
+    return totalNodes;
 }
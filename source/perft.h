@@ -1,4 +1,87 @@
 #pragma once
 #include "board.h"
+#include "memory.h"
+#include "tt.h"
+#include <atomic>
+#include <memory>
 
-void Perft(Board &board, int depth);
\ No newline at end of file
+constexpr int defaultPerftThreads = 1;
+constexpr int defaultPerftHashMB = 64;
+
+// Subtree counts keyed by position and remaining depth. The key is stored xored with the data,
+// so an entry torn by two threads writing at once fails verification instead of giving a wrong count
+struct PerftEntry {
+    std::atomic<U64> key;
+    std::atomic<U64> data;
+};
+
+class PerftTable {
+private:
+    PerftEntry* table = nullptr;
+    U64 tableSize = 0;
+
+    MEMORY::LargeAllocation allocation;
+
+    // Layout: nodes 56 | depth 8
+    static U64 Pack(U64 nodes, int depth) {
+        return nodes << 8 | depth;
+    }
+
+    U64 Index(U64 hashKey) const {
+        return (unsigned __int128)hashKey * tableSize >> 64;
+    }
+public:
+    explicit PerftTable(U64 megabytes) {
+        tableSize = megabytes * MB / sizeof(PerftEntry);
+
+        allocation = MEMORY::AllocateLarge(tableSize * sizeof(PerftEntry));
+        table = static_cast<PerftEntry*>(allocation.data);
+
+        // Runs without caching if the memory is not there
+        if (!table)
+            tableSize = 0;
+
+        std::uninitialized_value_construct(table, table + tableSize);
+    }
+
+    ~PerftTable() {
+        MEMORY::FreeLarge(allocation);
+    }
+
+    PerftTable(const PerftTable&) = delete;
+    PerftTable& operator=(const PerftTable&) = delete;
+
+    bool Probe(U64 hashKey, int depth, U64& nodes) const {
+        if (!tableSize)
+            return false;
+
+        const PerftEntry& entry = table[Index(hashKey)];
+
+        const U64 data = entry.data.load(std::memory_order_relaxed);
+        const U64 key = entry.key.load(std::memory_order_relaxed);
+
+        if ((key ^ data) != hashKey || int(data & 0xFF) != depth)
+            return false;
+
+        nodes = data >> 8;
+        return true;
+    }
+
+    void Store(U64 hashKey, int depth, U64 nodes) {
+        if (!tableSize)
+            return;
+
+        PerftEntry& entry = table[Index(hashKey)];
+        const U64 data = Pack(nodes, depth);
+
+        entry.key.store(hashKey ^ data, std::memory_order_relaxed);
+        entry.data.store(data, std::memory_order_relaxed);
+    }
+};
+
+// Counts the leaf nodes at the given depth, root moves are split across the threads and subtree counts are
+// cached in a table of hashMB megabytes, 0 disables it. Per move counts are printed when print is set
+U64 Perft(Board &board, int depth, int threads = defaultPerftThreads, int hashMB = defaultPerftHashMB, bool print = true);
+
+// Same, with a table owned by the caller so it can be reused across positions and depths. nullptr disables it
+U64 Perft(Board &board, int depth, int threads, PerftTable* table, bool print = true);
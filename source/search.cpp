@@ -106,8 +106,9 @@ bool IsDraw(Board &board, SearchContext* ctx) {
     return IsFifty(board) || IsInsuffMat(board) || IsTwoFold(board, ctx);
 }
 
+// The history score is looked up by the caller before the move is made on the board
 template <bool isPV>
-static int GetReductions(Board &board, Move &move, int depth, int moveSeen, int ply, bool cutnode, bool improving, bool corrplexity, bool ttpv, bool ttpvFailLow, SearchContext* ctx) {
+static int GetReductions(Move &move, int historyScore, int depth, int moveSeen, bool cutnode, bool improving, bool corrplexity, bool ttpv, bool ttpvFailLow) {
     int reduction = 0;
 
     // Late Move Reduction
@@ -132,31 +133,7 @@ static int GetReductions(Board &board, Move &move, int depth, int moveSeen, int
         reduction += lmrTTPVFailLow;
 
     // History LMR
-    int historyReduction = 0;
-
-    if (move.IsQuiet()) {
-        bool sourceThreatened = board.IsSquareThreatened(board.sideToMove, move.MoveFrom());
-        bool targetThreatened = board.IsSquareThreatened(board.sideToMove, move.MoveTo());
-
-        historyReduction = ctx->history[board.sideToMove][move.MoveFrom()][move.MoveTo()][sourceThreatened][targetThreatened];
-        if (ply > 0) {
-            historyReduction += ctx->conthist.GetNPly(board, move, ctx, ply, 1);
-
-            if (ply > 1)
-                historyReduction += ctx->conthist.GetNPly(board, move, ctx, ply, 2);
-        }
-    } else if (move.IsCapture()) {
-        int attackerType = board.GetPieceType(move.MoveFrom());
-        int targetType = board.GetPieceType(move.MoveTo());
-
-        if (move.GetFlags() == epCapture) {
-            targetType = Pawn;
-        }
-
-        historyReduction = ctx->capthist[board.sideToMove][attackerType][targetType][move.MoveTo()];
-    }
-
-    historyReduction = historyReduction / lmrHistoryDivisor;
+    int historyReduction = historyScore / lmrHistoryDivisor;
     reduction -= historyReduction * 1024;
 
     reduction /= 1024;
@@ -270,12 +247,12 @@ static SearchResults Quiescence(Board& board, int alpha, int beta, int ply, Sear
     if (ShouldStop<mode>(ctx)) return 0;
 
     if (ply + 1 >= MAX_DEPTH)
-        return NNUE::net.Evaluate(board, mode == datagen);
+        return NNUE::net->Evaluate(board, ctx->accStack.Get(ply, board), mode == datagen);
 
     if (ply > ctx->seldepth)
         ctx->seldepth = ply;
 
-    int bestScore = AdjustEval(board, ctx, NNUE::net.Evaluate(board, mode == datagen));
+    int bestScore = AdjustEval(board, ctx, NNUE::net->Evaluate(board, ctx->accStack.Get(ply, board), mode == datagen));
     ctx->ss[ply].eval = bestScore;
 
     TTEntry entry;
@@ -345,23 +322,24 @@ static SearchResults Quiescence(Board& board, int alpha, int beta, int ply, Sear
                 continue;
         }
 
-        if (!board.IsLegal(currMove)) continue;
-        Board copy = board;
-        copy.MakeMove(currMove);
-
         ctx->ss[ply].pieceType = board.GetPieceType(currMove.MoveFrom());
         ctx->ss[ply].moveTo = currMove.MoveTo();
         ctx->ss[ply].side = board.sideToMove;
 
-        if (copy.positionIndex >= ctx->positionHistory.size()) {
-            ctx->positionHistory.resize(copy.positionIndex + 100);
+        board.MakeMove(currMove, ctx->states[ply]);
+
+        if (board.positionIndex >= ctx->positionHistory.size()) {
+            ctx->positionHistory.resize(board.positionIndex + 100);
         }
-        ctx->positionHistory[copy.positionIndex] = copy.hashKey;
+        ctx->positionHistory[board.positionIndex] = board.hashKey;
         ctx->nodes++;
 
-        ctx->TT->PrefetchEntry(copy.hashKey);
+        ctx->TT->PrefetchEntry(board.hashKey);
+        ctx->accStack.Push(ply + 1, board);
 
-        int score = -Quiescence<isPV, mode>(copy, -beta, -alpha, ply + 1, ctx).score;
+        int score = -Quiescence<isPV, mode>(board, -beta, -alpha, ply + 1, ctx).score;
+
+        board.UnmakeMove(currMove, ctx->states[ply]);
 
         if (score >= beta) {
             ctx->TT->WriteEntry(board.hashKey, 0, score, CutNode, currMove, ttpv);
@@ -388,7 +366,7 @@ SearchResults PVS(Board& board, int depth, int alpha, int beta, int ply, SearchC
     if (ShouldStop<mode>(ctx)) return 0;
 
     if (ply + 1 >= MAX_DEPTH)
-        return NNUE::net.Evaluate(board, mode == datagen);
+        return NNUE::net->Evaluate(board, ctx->accStack.Get(ply, board), mode == datagen);
 
     if (ply > ctx->seldepth)
         ctx->seldepth = ply;
@@ -417,7 +395,7 @@ SearchResults PVS(Board& board, int depth, int alpha, int beta, int ply, SearchC
 
     if (depth <= 0) return Quiescence<isPV, mode>(board, alpha, beta, ply, ctx);
 
-    int rawEval = NNUE::net.Evaluate(board, mode == datagen);
+    int rawEval = NNUE::net->Evaluate(board, ctx->accStack.Get(ply, board), mode == datagen);
     const int staticEval = AdjustEval(board, ctx, rawEval);
     ctx->ss[ply].eval = staticEval;
 
@@ -465,26 +443,36 @@ SearchResults PVS(Board& board, int depth, int alpha, int beta, int ply, SearchC
             // Null Move Pruning
             if (ply > ctx->minNmpPly && ttAdjustedEval >= beta + nmpBetaMargin) {
                 if (depth > 1 && !board.InPossibleZug()) {
-                    Board copy = board;
-                    copy.MakeMove(Move());
+                    board.MakeMove(Move(), ctx->states[ply]);
 
                     const int reduction = 4 + improving + depth / 3 + entry.bestMove.IsCapture();
 
-                    ctx->TT->PrefetchEntry(copy.hashKey);
+                    ctx->TT->PrefetchEntry(board.hashKey);
+                    ctx->accStack.Push(ply + 1, board);
 
-                    int score = -PVS<false, mode>(copy, depth - reduction, -beta, -beta + 1, ply + 1, ctx, !cutnode).score;
+                    int score = -PVS<false, mode>(board, depth - reduction, -beta, -beta + 1, ply + 1, ctx, !cutnode).score;
 
-                    if (searchStopped.load(std::memory_order_relaxed)) return 0;
-                    if (score >= beta) {
-                        if (depth <= 14 || ctx->minNmpPly > 0) {
-                            return score > MATE_SCORE - MAX_DEPTH ? beta : score;
-                        }
+                    // The verification search runs on the null move position too, so it has to happen before unmaking
+                    const bool verify = score >= beta && depth > 14 && ctx->minNmpPly == 0
+                                     && !searchStopped.load(std::memory_order_relaxed);
+
+                    SearchResults verifResults;
 
+                    if (verify) {
                         ctx->minNmpPly = ply + (depth - reduction) * 3 / 4;
 
-                        const auto verifResults = PVS<false, mode>(copy, depth - reduction, beta - 1, beta, ply + 1, ctx, true);
+                        verifResults = PVS<false, mode>(board, depth - reduction, beta - 1, beta, ply + 1, ctx, true);
 
                         ctx->minNmpPly = 0;
+                    }
+
+                    board.UnmakeMove(Move(), ctx->states[ply]);
+
+                    if (searchStopped.load(std::memory_order_relaxed)) return 0;
+                    if (score >= beta) {
+                        if (!verify) {
+                            return score > MATE_SCORE - MAX_DEPTH ? beta : score;
+                        }
 
                         if (verifResults.score >= beta) {
                             return verifResults;
@@ -516,23 +504,25 @@ SearchResults PVS(Board& board, int depth, int alpha, int beta, int ply, SearchC
             if (!SEE(board, currMove, seeThreshold))
                 continue;
 
-            if (!board.IsLegal(currMove)) continue;
-            Board copy = board;
-            copy.MakeMove(currMove);
+            board.MakeMove(currMove, ctx->states[ply]);
 
-            if (copy.positionIndex >= ctx->positionHistory.size()) {
-                ctx->positionHistory.resize(copy.positionIndex + 100);
+            if (board.positionIndex >= ctx->positionHistory.size()) {
+                ctx->positionHistory.resize(board.positionIndex + 100);
             }
-            ctx->positionHistory[copy.positionIndex] = copy.hashKey;
+            ctx->positionHistory[board.positionIndex] = board.hashKey;
             ctx->nodes++;
 
-            int score = -Quiescence<isPV, mode>(copy, -probcutBeta, -probcutBeta + 1, ply + 1, ctx).score;
+            ctx->accStack.Push(ply + 1, board);
+
+            int score = -Quiescence<isPV, mode>(board, -probcutBeta, -probcutBeta + 1, ply + 1, ctx).score;
 
             if (score >= probcutBeta) {
-                score = -PVS<isPV, mode>(copy, probcutDepth - 1, -probcutBeta, -probcutBeta + 1,
+                score = -PVS<isPV, mode>(board, probcutDepth - 1, -probcutBeta, -probcutBeta + 1,
                     ply + 1, ctx, !cutnode).score;
             }
 
+            board.UnmakeMove(currMove, ctx->states[ply]);
+
             if (searchStopped.load(std::memory_order_relaxed)) return 0;
 
             if (score >= probcutBeta) {
@@ -606,21 +596,30 @@ SearchResults PVS(Board& board, int depth, int alpha, int beta, int ply, SearchC
             continue;
 
 
-        if (!board.IsLegal(currMove)) continue;
-        Board copy = board;
-        copy.MakeMove(currMove);
+        int reductionHistory = 0;
+
+        if (currMove.IsQuiet()) {
+            reductionHistory = historyScore;
+        } else if (currMove.IsCapture()) {
+            int attackerType = board.GetPieceType(currMove.MoveFrom());
+            int targetType = currMove.GetFlags() == epCapture ? Pawn : board.GetPieceType(currMove.MoveTo());
+
+            reductionHistory = ctx->capthist[board.sideToMove][attackerType][targetType][currMove.MoveTo()];
+        }
 
         ctx->ss[ply].pieceType = board.GetPieceType(currMove.MoveFrom());
         ctx->ss[ply].moveTo = currMove.MoveTo();
         ctx->ss[ply].side = board.sideToMove;
 
-        if (copy.positionIndex >= ctx->positionHistory.size()) {
-            ctx->positionHistory.resize(copy.positionIndex + 100);
+        board.MakeMove(currMove, ctx->states[ply]);
+
+        if (board.positionIndex >= ctx->positionHistory.size()) {
+            ctx->positionHistory.resize(board.positionIndex + 100);
         }
-        ctx->positionHistory[copy.positionIndex] = copy.hashKey;
+        ctx->positionHistory[board.positionIndex] = board.hashKey;
         ctx->nodes++;
 
-        ctx->TT->PrefetchEntry(copy.hashKey);
+        ctx->TT->PrefetchEntry(board.hashKey);
 
         int extension = 0;
 
@@ -633,6 +632,9 @@ SearchResults PVS(Board& board, int depth, int alpha, int beta, int ply, SearchC
                 const int sBeta = std::max(-inf + 1, entry.score - depth * 2);
                 const int sDepth = (depth - 1) / 2;
 
+                // The singular search looks at the parent position, the move is made again afterwards
+                board.UnmakeMove(currMove, ctx->states[ply]);
+
                 ctx->excluded = currMove;
                 const int singularScore = PVS<false, mode>(board, sDepth, sBeta-1, sBeta, ply, ctx, cutnode).score;
                 ctx->excluded = Move();
@@ -658,25 +660,30 @@ SearchResults PVS(Board& board, int depth, int alpha, int beta, int ply, SearchC
                 } else if (cutnode) {
                     extension--;
                 }
+
+                board.MakeMove(currMove, ctx->states[ply]);
             } else if (depth <= 7 && !inCheck && staticEval <= alpha - ldseMargin && entry.nodeType == CutNode) {
                 extension++;
             }
         }
 
+        // Pushed after the singular search, which reuses the child slot
+        ctx->accStack.Push(ply + 1, board);
+
         cutnode |= extension < 0;
 
 
-        int newDepth = depth + (copy.InCheck() && !ctx->excluded) - 1 + extension;
+        int newDepth = depth + (board.InCheck() && !ctx->excluded) - 1 + extension;
 
         U64 nodesBeforeSearch = ctx->nodes;
 
         if (depth >= 2 && moveSeen >= 2 + (2 * isPV)) {
             const bool ttpvFailLow = ttpv && ttHit && entry.score <= alpha;
 
-            int reductions = GetReductions<isPV>(board, currMove, depth, moveSeen, ply, cutnode, improving, corrplexity, ttpv, ttpvFailLow, ctx);
+            int reductions = GetReductions<isPV>(currMove, reductionHistory, depth, moveSeen, cutnode, improving, corrplexity, ttpv, ttpvFailLow);
             int reduced = newDepth - reductions;
 
-            score = -PVS<false, mode>(copy, reduced, -alpha - 1, -alpha, ply + 1, ctx, true).score;
+            score = -PVS<false, mode>(board, reduced, -alpha - 1, -alpha, ply + 1, ctx, true).score;
 
             if (score > alpha && reduced < newDepth) {
                 const bool goDeeper = score > results.score + lmrDeeperBase + 4 * newDepth;
@@ -684,16 +691,18 @@ SearchResults PVS(Board& board, int depth, int alpha, int beta, int ply, SearchC
 
                 newDepth += goDeeper - goShallower;
 
-                score = -PVS<false, mode>(copy, newDepth, -alpha - 1, -alpha, ply + 1, ctx, !cutnode).score;
+                score = -PVS<false, mode>(board, newDepth, -alpha - 1, -alpha, ply + 1, ctx, !cutnode).score;
             }
         } else if (!isPV || moveSeen > 0) {
-            score = -PVS<false, mode>(copy, newDepth, -alpha - 1, -alpha, ply + 1, ctx, !cutnode).score;
+            score = -PVS<false, mode>(board, newDepth, -alpha - 1, -alpha, ply + 1, ctx, !cutnode).score;
         }
 
         if (isPV && (moveSeen == 0 || score > alpha)) {
-            score = -PVS<true, mode>(copy, newDepth, -beta, -alpha, ply + 1, ctx, false).score;
+            score = -PVS<true, mode>(board, newDepth, -beta, -alpha, ply + 1, ctx, false).score;
         }
 
+        board.UnmakeMove(currMove, ctx->states[ply]);
+
         moveSeen++;
 
         // Root
@@ -906,7 +915,7 @@ static SearchResults ID(Board &board, SearchParams params, SearchContext* ctx) {
                     }
                 }
             } else if constexpr (mode == datagen) {
-                if (ctx->nodes >= DATAGEN::SOFT_NODES) {
+                if (ctx->nodes >= ctx->nodesToGo) {
                     searchStopped.store(true, std::memory_order_relaxed);
                     break;
                 }
@@ -931,9 +940,13 @@ SearchResults SearchPosition(Board &board, SearchParams params, SearchContext* c
 
         if constexpr (mode == nodesMode) {
             ctx->nodesToGo = params.nodes;
+        } else if constexpr (mode == datagen) {
+            // A node count given by the caller replaces the soft limit, the hard limit stays
+            ctx->nodesToGo = params.nodes > 0 ? params.nodes : DATAGEN::SOFT_NODES;
         }
     }
     ctx->pvLine.Clear();
+    ctx->accStack.Reset(board);
 
     SearchResults results = ID<mode>(board, params, ctx);
 
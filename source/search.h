@@ -23,6 +23,9 @@ enum searchMode {
 constexpr int MATE_SCORE = 32767;
 constexpr int MAX_DEPTH = 256;
 constexpr int MAX_HISTORY = 16384;
+
+// Histories survive between searches and are divided by this at the start of each one
+constexpr int HISTORY_AGE_DIVISOR = 2;
 constexpr int WIN_SCORE = 30000;
 
 constexpr int CORRHIST_WEIGHT_SCALE = 256;
@@ -71,6 +74,11 @@ public:
         std::fill(&historyMoves[0][0][0][0], &historyMoves[0][0][0][0] + sizeof(historyMoves) / sizeof(int), 0);
     }
 
+    void Age() {
+        for (int* it = &historyMoves[0][0][0][0]; it != &historyMoves[0][0][0][0] + sizeof(historyMoves) / sizeof(int); it++)
+            *it /= HISTORY_AGE_DIVISOR;
+    }
+
     auto& operator[](int index) {
         return historyMoves[index];
     }
@@ -108,6 +116,13 @@ public:
         std::fill(&nonPawnHist[0][0], &nonPawnHist[0][0] + sizeof(nonPawnHist) / sizeof(int), 0);
         std::fill(&majorHist[0][0], &majorHist[0][0] + sizeof(majorHist) / sizeof(int), 0);
     }
+
+    void Age() {
+        for (auto* hist : {&pawnHist, &nonPawnHist, &majorHist}) {
+            for (int* it = &(*hist)[0][0]; it != &(*hist)[0][0] + sizeof(*hist) / sizeof(int); it++)
+                *it /= HISTORY_AGE_DIVISOR;
+        }
+    }
 };
 
 class ContHistory {
@@ -126,6 +141,11 @@ public:
         std::fill(&contHistMoves[0][0][0][0][0][0], &contHistMoves[0][0][0][0][0][0] + sizeof(contHistMoves) / sizeof(int16_t), 0);
     }
 
+    void Age() {
+        for (int16_t* it = &contHistMoves[0][0][0][0][0][0]; it != &contHistMoves[0][0][0][0][0][0] + sizeof(contHistMoves) / sizeof(int16_t); it++)
+            *it /= HISTORY_AGE_DIVISOR;
+    }
+
     int16_t GetNPly(Board& board, Move& move, SearchContext* ctx, int ply, int n);
 
     auto& operator[](int index) {
@@ -148,6 +168,11 @@ public:
         std::fill(&historyMoves[0][0][0][0][0], &historyMoves[0][0][0][0][0] + sizeof(historyMoves) / sizeof(int), 0);
     }
 
+    void Age() {
+        for (int* it = &historyMoves[0][0][0][0][0]; it != &historyMoves[0][0][0][0][0] + sizeof(historyMoves) / sizeof(int); it++)
+            *it /= HISTORY_AGE_DIVISOR;
+    }
+
     auto& operator[](int index) {
         return historyMoves[index];
     }
@@ -247,18 +272,35 @@ public:
 
     std::array<Stack, MAX_DEPTH> ss{};
 
+    // Undo information for the move made at each ply
+    std::array<BoardState, MAX_DEPTH> states{};
+
+    ACC::AccumulatorStack accStack = ACC::AccumulatorStack(MAX_DEPTH);
+
     Stopwatch sw;
 
     SearchContext(){
         pvLine.Clear();
+        ClearHistories();
+        sw.Restart();
+        ss = {};
+        positionHistory.resize(1000);
+    }
+
+    // Everything learned about move ordering and eval correction, kept until a new game
+    void ClearHistories() {
         history.Clear();
         conthist.Clear();
         corrhist.Clear();
         capthist.Clear();
-        sw.Restart();
         killerMoves = {};
-        ss = {};
-        positionHistory.resize(1000);
+    }
+
+    void AgeHistories() {
+        history.Age();
+        conthist.Age();
+        corrhist.Age();
+        capthist.Age();
     }
 };
 
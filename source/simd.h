@@ -0,0 +1,123 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Native vector abstraction shared by NNUE inference and accumulator updates
+
+#if defined(__x86_64__) || defined(__amd64__) || (defined(_WIN64) && (defined(_M_X64) || defined(_M_AMD64)))
+#include <immintrin.h>
+#if defined(__AVX512F__)
+#define SIMD_BACKEND "AVX512"
+using nativeVector = __m512i;
+#define set1_epi16 _mm512_set1_epi16
+#define load_epi16 _mm512_load_si512
+#define store_epi16 _mm512_store_si512
+#define add_epi16 _mm512_add_epi16
+#define sub_epi16 _mm512_sub_epi16
+#define min_epi16 _mm512_min_epi16
+#define max_epi16 _mm512_max_epi16
+#define madd_epi16 _mm512_madd_epi16
+#define mullo_epi16 _mm512_mullo_epi16
+#define add_epi32 _mm512_add_epi32
+#define reduce_epi32 _mm512_reduce_add_epi32
+#elif defined(__AVX2__)
+#define SIMD_BACKEND "AVX2"
+using nativeVector = __m256i;
+#define set1_epi16 _mm256_set1_epi16
+#define load_epi16 _mm256_load_si256
+#define store_epi16 _mm256_store_si256
+#define add_epi16 _mm256_add_epi16
+#define sub_epi16 _mm256_sub_epi16
+#define min_epi16 _mm256_min_epi16
+#define max_epi16 _mm256_max_epi16
+#define madd_epi16 _mm256_madd_epi16
+#define mullo_epi16 _mm256_mullo_epi16
+#define add_epi32 _mm256_add_epi32
+#define reduce_epi32 \
+    [](nativeVector vec) { \
+        __m128i xmm1 = _mm256_extracti128_si256(vec, 1); \
+        __m128i xmm0 = _mm256_castsi256_si128(vec); \
+        xmm0         = _mm_add_epi32(xmm0, xmm1); \
+        xmm1         = _mm_shuffle_epi32(xmm0, 238); \
+        xmm0         = _mm_add_epi32(xmm0, xmm1); \
+        xmm1         = _mm_shuffle_epi32(xmm0, 85); \
+        xmm0         = _mm_add_epi32(xmm0, xmm1); \
+        return _mm_cvtsi128_si32(xmm0); \
+    }
+#else
+#define SIMD_BACKEND "SSE"
+using nativeVector = __m128i;
+#define set1_epi16 _mm_set1_epi16
+#define load_epi16 _mm_load_si128
+#define store_epi16 _mm_store_si128
+#define add_epi16 _mm_add_epi16
+#define sub_epi16 _mm_sub_epi16
+#define min_epi16 _mm_min_epi16
+#define max_epi16 _mm_max_epi16
+#define madd_epi16 _mm_madd_epi16
+#define mullo_epi16 _mm_mullo_epi16
+#define add_epi32 _mm_add_epi32
+#define reduce_epi32 \
+    [](nativeVector vec) { \
+        __m128i xmm1 = _mm_shuffle_epi32(vec, 238); \
+        vec          = _mm_add_epi32(vec, xmm1); \
+        xmm1         = _mm_shuffle_epi32(vec, 85); \
+        vec          = _mm_add_epi32(vec, xmm1); \
+        return _mm_cvtsi128_si32(vec); \
+    }
+#endif
+
+#elif defined(__aarch64__)
+#define SIMD_BACKEND "ARM64 (NEON)"
+#include <arm_neon.h>
+using nativeVector = int16x8_t;
+static inline nativeVector set1_epi16(int16_t v) {
+    return vdupq_n_s16(v);
+}
+static inline nativeVector load_epi16(const nativeVector* ptr) {
+    return *ptr;
+}
+static inline void store_epi16(nativeVector* ptr, nativeVector v) {
+    *ptr = v;
+}
+static inline nativeVector add_epi16(nativeVector a, nativeVector b) {
+    return vaddq_s16(a, b);
+}
+static inline nativeVector sub_epi16(nativeVector a, nativeVector b) {
+    return vsubq_s16(a, b);
+}
+static inline nativeVector min_epi16(nativeVector a, nativeVector b) {
+    return vminq_s16(a, b);
+}
+static inline nativeVector max_epi16(nativeVector a, nativeVector b) {
+    return vmaxq_s16(a, b);
+}
+static inline int32x4_t madd_epi16(nativeVector a, nativeVector b) {
+    int32x4_t lo = vmull_s16(vget_low_s16(a), vget_low_s16(b));
+    int32x4_t hi = vmull_s16(vget_high_s16(a), vget_high_s16(b));
+    int32x4_t sum_lo = vpaddq_s32(lo, lo);
+    int32x4_t sum_hi = vpaddq_s32(hi, hi);
+    return vcombine_s32(vget_low_s32(sum_lo), vget_low_s32(sum_hi));
+}
+static inline nativeVector mullo_epi16(nativeVector a, nativeVector b) {
+    return vmulq_s16(a, b);
+}
+static inline int32x4_t add_epi32(int32x4_t a, int32x4_t b) {
+    return vaddq_s32(a, b);
+}
+static inline int reduce_epi32(int32x4_t v) {
+    int32x2_t pair = vadd_s32(vget_low_s32(v), vget_high_s32(v));
+    int32x2_t total = vpadd_s32(pair, pair);
+    return vget_lane_s32(total, 0);
+}
+
+#else
+#define SIMD_BACKEND "fallback scalar"
+using nativeVector = void*;
+#endif
+
+constexpr size_t VECTOR_SIZE = sizeof(nativeVector) / sizeof(int16_t);
+
+// Number of registers used to hold a tile of running sums during accumulator updates
+constexpr size_t TILE_REGS = 16;
+constexpr size_t TILE_SIZE = VECTOR_SIZE * TILE_REGS;
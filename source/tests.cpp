@@ -4,6 +4,13 @@
 #include "tests.h"
 #include "utils.h"
 #include "search.h"
+#include "perft.h"
+#include "stopwatch.h"
+#include "nnue.h"
+#include <filesystem>
+#include <atomic>
+#include <thread>
+#include <algorithm>
 
 namespace TEST {
 
@@ -40,4 +47,172 @@ void SEE() {
 	}
 }
 
-}
\ No newline at end of file
+struct PerftCase {
+	std::string fen;
+	std::vector<std::pair<int, U64>> expected;
+	std::vector<U64> counts;
+};
+
+static std::string Trim(std::string str) {
+	str.erase(0, str.find_first_not_of(" \t\r\n"));
+	str.erase(str.find_last_not_of(" \t\r\n") + 1);
+	return str;
+}
+
+bool PerftSuite(const std::string& path, int threads, int hashMB) {
+	std::ifstream file(path);
+
+	if (!file) {
+		std::cerr << "Could not open perft suite " << path << std::endl;
+		return false;
+	}
+
+	std::vector<PerftCase> cases;
+	std::string line;
+
+	while (std::getline(file, line)) {
+		if (Trim(line).empty()) continue;
+
+		std::vector tokens = UTILS::split(line, ';');
+
+		PerftCase perftCase;
+		perftCase.fen = Trim(tokens[0]);
+
+		for (size_t i = 1; i < tokens.size(); i++) {
+			std::string token = Trim(tokens[i]);
+			size_t space = token.find(' ');
+
+			if (token.empty() || token[0] != 'D' || space == std::string::npos) {
+				std::cerr << "Malformed perft record: " << line << std::endl;
+				return false;
+			}
+
+			perftCase.expected.emplace_back(std::stoi(token.substr(1, space - 1)), std::stoull(token.substr(space + 1)));
+		}
+
+		cases.push_back(perftCase);
+	}
+
+	threads = std::clamp<int>(threads, 1, std::max<size_t>(cases.size(), 1));
+
+	// Every thread has its own perft table, so the hash is split between them
+	const int threadHash = hashMB > 0 ? std::max(hashMB / threads, 1) : 0;
+
+	std::atomic<size_t> nextCase = 0;
+	std::atomic<U64> totalNodes = 0;
+
+	auto worker = [&]() {
+		Board board;
+
+		// Kept for every case this thread runs, entries are keyed by position and depth
+		std::unique_ptr<PerftTable> table;
+		if (threadHash > 0)
+			table = std::make_unique<PerftTable>(threadHash);
+
+		for (size_t i = nextCase++; i < cases.size(); i = nextCase++) {
+			board.SetByFen(cases[i].fen);
+
+			for (auto [depth, expected] : cases[i].expected) {
+				U64 count = Perft(board, depth, 1, table.get(), false);
+
+				cases[i].counts.push_back(count);
+				totalNodes += count;
+			}
+		}
+	};
+
+	Stopwatch sw;
+
+	std::vector<std::thread> workers;
+	workers.reserve(threads - 1);
+
+	for (int id = 1; id < threads; id++)
+		workers.emplace_back(worker);
+
+	worker();
+
+	for (auto& thread : workers)
+		thread.join();
+
+	const double elapsed = sw.GetElapsedSec();
+	int mismatches = 0;
+
+	for (const PerftCase& perftCase : cases) {
+		for (size_t i = 0; i < perftCase.expected.size(); i++) {
+			const auto [depth, expected] = perftCase.expected[i];
+
+			if (perftCase.counts[i] != expected) {
+				std::cout << "FAILED " << perftCase.fen << " depth " << depth
+					<< ": expected " << expected << ", got " << perftCase.counts[i] << std::endl;
+				mismatches++;
+			}
+		}
+	}
+
+	std::cout << "Positions: " << cases.size() << std::endl;
+	std::cout << "Mismatches: " << mismatches << std::endl;
+	std::cout << "Total nodes: " << totalNodes << std::endl;
+	std::cout << "Time took: " << elapsed << "s (";
+	std::cout << U64(totalNodes / elapsed) << " nodes/sec)" << std::endl;
+
+	return mismatches == 0;
+}
+
+static bool LoadsAs(const std::string& name, const std::vector<unsigned char>& data, bool expected) {
+	const std::filesystem::path path = std::filesystem::temp_directory_path() / "eleanor-nettest.nnue";
+
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(data.data()), data.size());
+	}
+
+	const bool loaded = NNUE::LoadNetwork(path.string());
+
+	std::error_code ec;
+	std::filesystem::remove(path, ec);
+
+	std::cout << (loaded == expected ? "PASSED " : "FAILED ") << name
+		<< (expected ? " is loaded" : " is rejected") << std::endl;
+
+	return loaded == expected;
+}
+
+bool NetworkFiles() {
+	const auto* weights = reinterpret_cast<const unsigned char*>(NNUE::net);
+	const NNUE::NetworkHeader header = NNUE::MakeNetworkHeader(weights);
+
+	const auto withHeader = [&](const NNUE::NetworkHeader& h) {
+		std::vector<unsigned char> data(reinterpret_cast<const unsigned char*>(&h),
+			reinterpret_cast<const unsigned char*>(&h) + sizeof(h));
+		data.insert(data.end(), weights, weights + NNUE::NETWORK_BYTES);
+		return data;
+	};
+
+	bool passed = true;
+
+	passed &= LoadsAs("headered network", withHeader(header), true);
+	passed &= LoadsAs("raw network", std::vector<unsigned char>(weights, weights + NNUE::NETWORK_BYTES), true);
+
+	std::vector<unsigned char> corrupted = withHeader(header);
+	corrupted[sizeof(NNUE::NetworkHeader) + NNUE::NETWORK_BYTES / 2] ^= 1;
+	passed &= LoadsAs("network with a flipped weight bit", corrupted, false);
+
+	NNUE::NetworkHeader otherArch = header;
+	otherArch.archHash ^= 1;
+	passed &= LoadsAs("network for another architecture", withHeader(otherArch), false);
+
+	NNUE::NetworkHeader otherVersion = header;
+	otherVersion.version++;
+	passed &= LoadsAs("network of another version", withHeader(otherVersion), false);
+
+	std::vector<unsigned char> truncated = withHeader(header);
+	truncated.resize(truncated.size() - 2);
+	passed &= LoadsAs("truncated network", truncated, false);
+
+	passed &= NNUE::LoadNetwork(std::string(NNUE::EMBEDDED_NETWORK));
+
+	std::cout << (passed ? "All network checks passed" : "Network checks FAILED") << std::endl;
+	return passed;
+}
+
+}
@@ -1,7 +1,16 @@
 #pragma once
+#include <string>
 
 namespace TEST {
 
 void SEE();
 
-}
\ No newline at end of file
+// Checks the perft counts of an EPD with records like "<fen> ;D1 20 ;D2 400", positions are spread over
+// the threads. Prints every mismatch and the overall nodes/sec, returns false on any mismatch or a missing file
+bool PerftSuite(const std::string& path = "tests/perftsuite.epd", int threads = 1, int hashMB = 64);
+
+// Writes the active network to temporary files, intact and damaged in several ways, and checks that only the
+// intact one loads. The embedded network is active again afterwards, returns false if any file was misjudged
+bool NetworkFiles();
+
+}
@@ -1,50 +1,121 @@
 #include "tt.h"
+#include <thread>
+#include <algorithm>
+#include <vector>
 
 TTable SharedTT;
 
+bool TTable::Resize(U64 size, int threadCount) {
+    MEMORY::LargeAllocation resized = MEMORY::AllocateLarge(size * sizeof(TTCluster));
+
+    // The old table stays in use when the new one does not fit
+    if (!resized.data) return false;
+
+    MEMORY::FreeLarge(allocation);
+
+    allocation = resized;
+    table = static_cast<TTCluster*>(allocation.data);
+    tableSize = size;
+
+    Clear(threadCount);
+    return true;
+}
+
+void TTable::Clear(int threadCount) {
+    if (tableSize == 0) return;
+
+    threadCount = std::clamp<U64>(threadCount, 1, tableSize);
+
+    const U64 chunk = tableSize / threadCount;
+
+    auto clearChunk = [this, chunk, threadCount](int id) {
+        const U64 begin = id * chunk;
+        const U64 end = id == threadCount - 1 ? tableSize : begin + chunk;
+
+        std::uninitialized_value_construct(table + begin, table + end);
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threadCount - 1);
+
+    for (int id = 1; id < threadCount; id++)
+        workers.emplace_back(clearChunk, id);
+
+    clearChunk(0);
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+uint64_t TTable::Pack(uint16_t key, Move move, int score, int depth, int nodeType, bool ttpv, uint8_t age) {
+    const uint16_t moveData = move.MoveFrom() | move.MoveTo() << 6 | move.GetFlags() << 12;
+
+    return uint64_t(key)
+         | uint64_t(moveData) << 16
+         | uint64_t(uint16_t(score)) << 32
+         | uint64_t(uint8_t(depth)) << 48
+         | uint64_t(nodeType + 1) << 56
+         | uint64_t(ttpv) << 58
+         | uint64_t(age & AGE_MASK) << 59;
+}
+
+TTEntry TTable::Unpack(uint64_t data, U64 hashKey) {
+    TTEntry entry;
+
+    const uint16_t moveData = data >> 16;
+    entry.bestMove = Move(moveData & 0x3F, (moveData >> 6) & 0x3F, moveData >> 12);
+
+    entry.hashKey = hashKey;
+    entry.score = int16_t(data >> 32);
+    entry.depth = uint8_t(data >> 48);
+    entry.nodeType = ((data >> 56) & 3) - 1;
+    entry.ttpv = (data >> 58) & 1;
+    entry.age = (data >> 59) & AGE_MASK;
+
+    return entry;
+}
+
 void TTable::WriteEntry(U64 &hashKey, int depth, int score, int nodeType, Move bestMove, bool ttpv) {
-    TTBucket *bucket = &table[hashKey % table.size()];
-    TTEntry *current = nullptr;
-
-    if (bucket->depthPreferred && bucket->depthPreferred.hashKey == hashKey) {
-        current = &bucket->depthPreferred;
-    } else if (bucket->alwaysReplace && bucket->alwaysReplace.hashKey == hashKey) {
-        current = &bucket->alwaysReplace;
-    } else if (!bucket->alwaysReplace) {
-        current = &bucket->alwaysReplace;
-    } else if (!bucket->depthPreferred) {
-        current = &bucket->depthPreferred;
-    } else if (ttpv) {
-        current = &bucket->depthPreferred;
-    } else {
-        const int depthPreferredValue = GetReplacementValue(bucket->depthPreferred);
-        const int alwaysReplaceValue = GetReplacementValue(bucket->alwaysReplace);
-
-        if (depthPreferredValue <= alwaysReplaceValue) {
-            current = &bucket->depthPreferred;
-        } else {
-            current = &bucket->alwaysReplace;
+    TTCluster& cluster = table[Index(hashKey)];
+    const uint16_t key = KeyFragment(hashKey);
+
+    std::atomic<uint64_t>* slot = nullptr;
+    uint64_t slotData = 0;
+    int worstValue = 0;
+
+    // Same position or an empty slot first, otherwise the least valuable entry
+    for (auto& entry : cluster.entries) {
+        const uint64_t data = entry.load(std::memory_order_relaxed);
+
+        if (!data || uint16_t(data) == key) {
+            slot = &entry;
+            slotData = data;
+            break;
+        }
+
+        const int value = GetReplacementValue(Unpack(data, hashKey));
+
+        if (!slot || value < worstValue) {
+            slot = &entry;
+            slotData = data;
+            worstValue = value;
         }
     }
 
-    const bool samePosition = current->hashKey == hashKey;
+    const TTEntry current = Unpack(slotData, hashKey);
+
+    const bool samePosition = slotData && uint16_t(slotData) == key;
     const bool exactBound = nodeType == PV;
-    const bool entryFromCurrentAge = current->age == age;
+    const bool entryFromCurrentAge = current.age == age;
     const int writeDepth = depth + 4 + ttpv * 2;
 
-    if (samePosition && !exactBound && entryFromCurrentAge && writeDepth <= current->depth) {
+    if (samePosition && !exactBound && entryFromCurrentAge && writeDepth <= current.depth) {
         return;
     }
 
-    current->hashKey = hashKey;
-    current->nodeType = nodeType;
-    current->score = score;
-    current->depth = depth;
-    
-    if (bestMove || !samePosition) {
-        current->bestMove = bestMove;
+    if (!bestMove && samePosition) {
+        bestMove = current.bestMove;
     }
 
-    current->age = age;
-    current->ttpv = ttpv;
+    slot->store(Pack(key, bestMove, score, depth, nodeType, ttpv, age), std::memory_order_relaxed);
 }
@@ -1,6 +1,9 @@
 #pragma once
 #include "board.h"
-#include <vector>
+#include "memory.h"
+#include <memory>
+#include <atomic>
+#include <array>
 
 class SearchResults {
 public:
@@ -40,54 +43,96 @@ public:
     }
 };
 
-class TTBucket {
-public:
-    TTEntry depthPreferred;
-    TTEntry alwaysReplace;
+// A cluster holds several entries packed into single 64-bit words, so concurrent
+// probes and writes from other threads never observe a torn entry
+constexpr int CLUSTER_SIZE = 4;
+
+struct alignas(32) TTCluster {
+    std::array<std::atomic<uint64_t>, CLUSTER_SIZE> entries;
 };
 
-// 1024 MB
-constexpr U64 maxHash = (1024 * 1000000) / sizeof(TTBucket);
+constexpr U64 MB = 1024 * 1024;
+
+// 1 TB, the Hash option is given in MB
+constexpr U64 maxHashMB = 1024 * 1024;
 // 8 MB
-constexpr U64 defaultHash = (8 * 1000000) / sizeof(TTBucket);
+constexpr U64 defaultHash = (8 * MB) / sizeof(TTCluster);
 
 constexpr int16_t invalidEntry = 11111;
 
 class TTable {
 private:
-    std::vector<TTBucket> table;
+    TTCluster* table = nullptr;
+    U64 tableSize = 0;
 
+    MEMORY::LargeAllocation allocation;
+
+    // 5 bits are stored per entry
+    static constexpr uint8_t AGE_MASK = 31;
     uint8_t age = 0;
 
     int GetReplacementValue(const TTEntry& entry) const {
-        const int ageDelta = uint8_t(age - entry.age);
+        const int ageDelta = (age - entry.age) & AGE_MASK;
         return entry.depth - ageDelta * 4 + entry.ttpv * 2;
     }
+
+    // Layout: key 16 | move 16 | score 16 | depth 8 | bound 2 | ttpv 1 | age 5
+    // The bound is stored off by one so an all-zero word marks an empty slot
+    // The index is taken from the high bits of the key, so the fragment uses the low ones
+    static uint16_t KeyFragment(U64 hashKey) {
+        return hashKey;
+    }
+
+    // Maps the key onto the table with a multiply-high instead of a 64-bit division
+    U64 Index(U64 hashKey) const {
+        return (unsigned __int128)hashKey * tableSize >> 64;
+    }
+
+    static uint64_t Pack(uint16_t key, Move move, int score, int depth, int nodeType, bool ttpv, uint8_t age);
+    static TTEntry Unpack(uint64_t data, U64 hashKey);
 public:
-    TTable() : table(defaultHash) {};
+    TTable() {
+        Resize(defaultHash, 1);
+    }
+
+    ~TTable() {
+        MEMORY::FreeLarge(allocation);
+    }
 
-    void Resize(U64 size) {
-        table.assign(size, {});
+    TTable(const TTable&) = delete;
+    TTable& operator=(const TTable&) = delete;
+
+    // Both split zeroing the table across the given number of threads.
+    // Resize returns false and keeps the current table if the new one cannot be allocated
+    bool Resize(U64 size, int threadCount);
+    void Clear(int threadCount);
+
+    U64 GetSizeMB() const {
+        return tableSize * sizeof(TTCluster) / MB;
     }
 
-    void Clear() {
-        std::fill(table.begin(), table.end(), TTBucket());
+    MEMORY::Backing GetBacking() const {
+        return allocation.backing;
     }
 
     void PrefetchEntry(U64 &hashKey) {
-        __builtin_prefetch(&table[hashKey % table.size()]);
+        __builtin_prefetch(&table[Index(hashKey)]);
     }
 
     void IncreaseAge() {
-        age++;
+        age = (age + 1) & AGE_MASK;
     }
 
     TTEntry GetEntry(U64 &hashKey) {
-        TTBucket *current = &table[hashKey % table.size()];
-        if (current->depthPreferred.hashKey == hashKey) {
-            return current->depthPreferred;
-        } else if (current->alwaysReplace.hashKey == hashKey) {
-            return current->alwaysReplace;
+        const TTCluster& cluster = table[Index(hashKey)];
+        const uint16_t key = KeyFragment(hashKey);
+
+        for (const auto& entry : cluster.entries) {
+            const uint64_t data = entry.load(std::memory_order_relaxed);
+
+            if (data && uint16_t(data) == key) {
+                return Unpack(data, hashKey);
+            }
         }
 
         return TTEntry();
@@ -97,8 +142,10 @@ public:
     int GetUsedPercentage() {
         int count = 0;
 
-        for (int i = 0; i < 1000; i++) {
-            if (table[i].depthPreferred || table[i].alwaysReplace) count++;
+        for (int i = 0; i < 1000 / CLUSTER_SIZE; i++) {
+            for (const auto& entry : table[i].entries) {
+                if (entry.load(std::memory_order_relaxed)) count++;
+            }
         }
 
         return count;
@@ -2,17 +2,20 @@
 #include <iostream>
 #include <cstring>
 #include <string>
-#include <tuple>
 #include <memory>
 #include <algorithm>
+#include <mutex>
+#include <condition_variable>
 #include "types.h"
 #include "movegen.h"
 #include "search.h"
 #include "benchmark.h"
 #include "perft.h"
+#include "tests.h"
 #include "utils.h"
 #include "datagen.h"
 #include "tunables.h"
+#include "nnue.h"
 
 // OS-dependent threading includes
 #ifdef _WIN32
@@ -24,6 +27,7 @@
 namespace {
 
 constexpr size_t DefaultPositionHistorySize = 1000;
+constexpr int MaxThreads = 512;
 
 static void EnsurePositionHistory(SEARCH::SearchContext* ctx, int positionIndex) {
     if (positionIndex >= static_cast<int>(ctx->positionHistory.size())) {
@@ -37,31 +41,125 @@ static void ResetPositionHistory(SEARCH::SearchContext* ctx, const Board& board)
     ctx->positionHistory[board.positionIndex] = board.hashKey;
 }
 
+// Search thread that lives until the thread count changes. Between searches it parks
+// on a condition variable and keeps its context, so a go neither spawns threads nor copies contexts
+class SearchWorker {
+private:
 #ifdef _WIN32
-static std::vector<std::thread> searchThreads;
+    std::thread thread;
 #else
-static std::vector<pthread_t> searchThreads;
+    pthread_t thread;
 #endif
 
-static void JoinSearchThreads() {
-#ifdef _WIN32
-    for (auto& thread : searchThreads) {
-        if (thread.joinable()) {
-            thread.join();
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool searching = false;
+    bool exit = false;
+
+    Board board;
+    SearchParams params;
+
+    void Loop() {
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return searching || exit; });
+
+            if (exit)
+                return;
+
+            lock.unlock();
+
+            if (params.nodes) {
+                SEARCH::SearchPosition<SEARCH::nodesMode>(board, params, ctx.get());
+            } else {
+                SEARCH::SearchPosition<SEARCH::normal>(board, params, ctx.get());
+            }
+
+            lock.lock();
+            searching = false;
+            cv.notify_all();
         }
     }
-#else
-    for (pthread_t& thread : searchThreads) {
-        pthread_join(thread, nullptr);
+
+#ifndef _WIN32
+    static void* ThreadFunc(void* arg) {
+        static_cast<SearchWorker*>(arg)->Loop();
+        return nullptr;
     }
 #endif
 
-    searchThreads.clear();
+public:
+    std::unique_ptr<SEARCH::SearchContext> ctx = std::make_unique<SEARCH::SearchContext>();
+
+    SearchWorker(bool isMain) {
+        ctx->doPrint = isMain;
+
+    #ifdef _WIN32
+        thread = std::thread(&SearchWorker::Loop, this);
+    #else
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, 8 * 1024 * 1024);  // 8 MB stack
+
+        if (pthread_create(&thread, &attr, ThreadFunc, this) != 0) {
+            std::cerr << "Failed to create search thread" << std::endl;
+            std::abort();
+        }
+
+        pthread_attr_destroy(&attr);
+    #endif
+    }
+
+    ~SearchWorker() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            exit = true;
+        }
+        cv.notify_all();
+
+    #ifdef _WIN32
+        thread.join();
+    #else
+        pthread_join(thread, nullptr);
+    #endif
+    }
+
+    void Start(const Board& pBoard, const SearchParams& pParams) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            board = pBoard;
+            params = pParams;
+            searching = true;
+        }
+        cv.notify_all();
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return !searching; });
+    }
+};
+
+static std::vector<std::unique_ptr<SearchWorker>> searchWorkers;
+
+static void WaitForSearchThreads() {
+    for (auto& worker : searchWorkers) {
+        worker->Wait();
+    }
 }
 
 static void StopSearchThreads() {
     searchStopped.store(true, std::memory_order_relaxed);
-    JoinSearchThreads();
+    WaitForSearchThreads();
+}
+
+static void ResizeSearchThreads(int count) {
+    StopSearchThreads();
+    searchWorkers.clear();
+
+    for (int i = 0; i < count; i++) {
+        searchWorkers.push_back(std::make_unique<SearchWorker>(i == 0));
+    }
 }
 
 } // namespace
@@ -94,8 +192,6 @@ static void ParsePosition(Board &board, std::string_view command, SEARCH::Search
             ctx->positionHistory[board.positionIndex] = board.hashKey;
         }
     }
-
-    MOVEGEN::GenerateMoves<All>(board, true);
 }
 
 static double ReadParam(const std::string& param, const std::string &command) {
@@ -136,78 +232,6 @@ static double ReadParam(const std::string& param, const std::string &command) {
 }
 
 
-#ifdef _WIN32
-// Windows implementation using std::thread
-template <SEARCH::searchMode mode>
-static void ThreadFunc(Board board, SearchParams params, SEARCH::SearchContext* ctx) {
-    SEARCH::SearchPosition<mode>(board, params, ctx);
-    delete ctx;
-}
-
-static void StartSearchThread(Board& board, SearchParams params, SEARCH::SearchContext* ctx, int id) {
-    SEARCH::SearchContext* ctxCopy = new SEARCH::SearchContext(*ctx);
-    if (id == 0)
-        ctxCopy->doPrint = true;
-
-    if (params.nodes) {
-        searchThreads.emplace_back(ThreadFunc<SEARCH::nodesMode>, board, params, ctxCopy);
-    } else {
-        searchThreads.emplace_back(ThreadFunc<SEARCH::normal>, board, params, ctxCopy);
-    }
-}
-
-#else
-// Unix/Linux implementation using pthread
-template <SEARCH::searchMode mode>
-static void* ThreadFunc(void* arg) {
-    auto* tup = static_cast<std::tuple<Board, SearchParams, SEARCH::SearchContext*>*>(arg);
-    SEARCH::SearchContext* ctx = std::get<2>(*tup);
-    SEARCH::SearchPosition<mode>(std::get<0>(*tup), std::get<1>(*tup), ctx);
-    delete ctx;
-    delete tup;
-    return nullptr;
-}
-
-static void StartSearchThread(Board& board, SearchParams params, SEARCH::SearchContext* ctx, int id) {
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setstacksize(&attr, 8 * 1024 * 1024);  // 8 MB stack
-
-    SEARCH::SearchContext* ctxCopy = new SEARCH::SearchContext(*ctx);
-    if (id == 0)
-        ctxCopy->doPrint = true;
-
-    pthread_t thread;
-    int rc = 0;
-
-    if (params.nodes) {
-        auto* arg = new std::tuple<Board, SearchParams, SEARCH::SearchContext*>(board, params, ctxCopy);
-        rc = pthread_create(&thread, &attr, ThreadFunc<SEARCH::nodesMode>, arg);
-        if (rc != 0) {
-            delete std::get<2>(*arg);
-            delete arg;
-            ctxCopy = nullptr;
-        }
-    } else {
-        auto* arg = new std::tuple<Board, SearchParams, SEARCH::SearchContext*>(board, params, ctxCopy);
-        rc = pthread_create(&thread, &attr, ThreadFunc<SEARCH::normal>, arg);
-        if (rc != 0) {
-            delete std::get<2>(*arg);
-            delete arg;
-            ctxCopy = nullptr;
-        }
-    }
-
-    pthread_attr_destroy(&attr);
-
-    if (rc == 0) {
-        searchThreads.push_back(thread);
-    } else {
-        delete ctxCopy;
-    }
-}
-#endif
-
 static void ParseGo(Board &board, std::string &command, SEARCH::SearchContext* ctx) {
     StopSearchThreads();
     searchStopped.store(false, std::memory_order_relaxed);
@@ -230,23 +254,66 @@ static void ParseGo(Board &board, std::string &command, SEARCH::SearchContext* c
         params.btime = 99999999;
     }
 
-    searchThreads.reserve(threads);
-    for (int i = 0; i < threads; i++) {
-        StartSearchThread(board, params, ctx, i);
+    for (auto& worker : searchWorkers) {
+        SEARCH::SearchContext* workerCtx = worker->ctx.get();
+
+        workerCtx->AgeHistories();
+        workerCtx->ss = {};
+        workerCtx->excluded = Move();
+        workerCtx->minNmpPly = 0;
+
+        workerCtx->TT = ctx->TT;
+        workerCtx->positionHistory = ctx->positionHistory;
+
+        worker->Start(board, params);
     }
 }
 
 static void SetOption(std::string& command, SEARCH::SearchContext* ctx) {
     StopSearchThreads();
 
+    // Checked first since the path itself may contain other option names
+    if (command.find("name EvalFile") != std::string::npos) {
+        const size_t valuePos = command.find(" value ");
+        if (valuePos == std::string::npos)
+            return;
+
+        const std::string path = command.substr(valuePos + 7);
+
+        if (NNUE::LoadNetwork(path)) {
+            std::cout << "info string Loaded network " << path << std::endl;
+        }
+        return;
+    }
+
+    if (command.find("name NetworkLargePages") != std::string::npos) {
+        NNUE::SetNetworkLargePages(command.find("value true") != std::string::npos
+            || command.find("value 1") != std::string::npos);
+        std::cout << "info string Network backed by " << NNUE::NetworkBacking() << std::endl;
+        return;
+    }
+
+    if (command.find("name SharedNetwork") != std::string::npos) {
+        NNUE::SetSharedNetwork(command.find("value true") != std::string::npos
+            || command.find("value 1") != std::string::npos);
+        return;
+    }
+
     if (command.find("Hash") != std::string::npos) {
-        U64 hashSize = (ReadParam("value", command) * 1000000ULL) / sizeof(TTEntry);
-        ctx->TT->Resize(hashSize);
+        const U64 megabytes = std::clamp<U64>(ReadParam("value", command), 1, maxHashMB);
+        if (!ctx->TT->Resize(megabytes * MB / sizeof(TTCluster), threads)) {
+            std::cout << "info string Failed to allocate " << megabytes << " MB for Hash, keeping "
+                      << ctx->TT->GetSizeMB() << " MB" << std::endl;
+            return;
+        }
+
+        std::cout << "info string Hash backed by " << MEMORY::BackingName(ctx->TT->GetBacking()) << std::endl;
         return;
     }
 
     if (command.find("Threads") != std::string::npos) {
-        threads = ReadParam("value", command);
+        threads = std::clamp<int>(ReadParam("value", command), 1, MaxThreads);
+        ResizeSearchThreads(threads);
         return;
     }
 
@@ -303,14 +370,20 @@ static void SetOption(std::string& command, SEARCH::SearchContext* ctx) {
 static void PrintEngineInfo() {
     std::cout << "id name Eleanor v4.1" << std::endl;
     std::cout << "id author rektdie" << std::endl;
-    std::cout << "option name Hash type spin default 8 min 1 max 1024" << std::endl;
-    std::cout << "option name Threads type spin default 1 min 1 max 512" << std::endl;
+    std::cout << "option name Hash type spin default 8 min 1 max " << maxHashMB << std::endl;
+    std::cout << "option name Threads type spin default 1 min 1 max " << MaxThreads << std::endl;
     std::cout << "option name UCI_ShowWDL type check default false" << std::endl;
+    std::cout << "option name EvalFile type string default " << NNUE::EMBEDDED_NETWORK << std::endl;
+    std::cout << "option name SharedNetwork type check default false" << std::endl;
+    std::cout << "option name NetworkLargePages type check default false" << std::endl;
 
     #ifdef TUNING
         PrintTunablesUCI();
     #endif
 
+    std::cout << "info string Hash backed by " << MEMORY::BackingName(SharedTT.GetBacking()) << std::endl;
+    std::cout << "info string Network backed by " << NNUE::NetworkBacking() << std::endl;
+
     std::cout << "uciok" << std::endl;
 }
 
@@ -319,6 +392,8 @@ void UCILoop(Board &board) {
 
     auto ctx = std::make_unique<SEARCH::SearchContext>();
 
+    ResizeSearchThreads(threads);
+
     // main loop
     while (true) {
         std::getline(std::cin, input);
@@ -342,14 +417,13 @@ void UCILoop(Board &board) {
             board.SetByFen(StartingFen);
 
             // Clearing
-            ctx->TT->Clear();
+            ctx->TT->Clear(threads);
+
+            for (auto& worker : searchWorkers) {
+                worker->ctx->ClearHistories();
+            }
 
-            ctx->killerMoves = {};
-            ctx->history.Clear();
-            ctx->conthist.Clear();
-            ctx->corrhist.Clear();
             ResetPositionHistory(ctx.get(), board);
-            ctx->ss = {};
 
             continue;
         }
@@ -362,7 +436,7 @@ void UCILoop(Board &board) {
 
         // parse UCI "quit" command
         if (input.find("quit") != std::string::npos) {
-            StopSearchThreads();
+            ResizeSearchThreads(0);
             // stop the loop
             break;
         }
@@ -392,8 +466,21 @@ void UCILoop(Board &board) {
             continue;
         }
 
+        // perftsuite [threads=<n>] [hash=<mb>], runs tests/perftsuite.epd
+        if (input.find("perftsuite") != std::string::npos) {
+            const int perftThreads = input.find("threads") != std::string::npos ? ReadParam("threads", input) : defaultPerftThreads;
+            const int perftHash = input.find("hash") != std::string::npos ? ReadParam("hash", input) : defaultPerftHashMB;
+
+            TEST::PerftSuite("tests/perftsuite.epd", perftThreads, perftHash);
+            continue;
+        }
+
+        // perft <depth> [threads=<n>] [hash=<mb>]
         if (input.find("perft") != std::string::npos) {
-            Perft(board, ReadParam("perft", input));
+            const int perftThreads = input.find("threads") != std::string::npos ? ReadParam("threads", input) : defaultPerftThreads;
+            const int perftHash = input.find("hash") != std::string::npos ? ReadParam("hash", input) : defaultPerftHashMB;
+
+            Perft(board, ReadParam("perft", input), perftThreads, perftHash);
             continue;
         }
 
@@ -5,54 +5,85 @@ namespace UTILS {
 
 // Zobrist //
 
-U64 initialSeed = 0x60919C48E57863B9;
+constexpr U64 initialSeed = 0x60919C48E57863B9;
 
 // PRNG using xorshift
-static U64 RandomU64() {
-    initialSeed ^= initialSeed << 13;
-    initialSeed ^= initialSeed >> 7;
-    initialSeed ^= initialSeed << 17;
-    return initialSeed;
+static constexpr U64 XorShift(U64& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
 }
 
-bool RandomBool() {
-    return (RandomU64() & 1) == 1;
-}
+struct ZobristKeys {
+    MultiArray<U64, 2, 6, 64> pieces{};
+    std::array<U64, 8> enPassant{};
+    std::array<U64, 16> castle{};
+    U64 side = 0ULL;
 
-int RandomInt(int min, int max) {
-    if (max < min) {
-        int temp = min;
-        min = max;
-        max = temp;
-    }
+    // Where the generator stopped, the runtime stream carries on from here
+    U64 finalState = 0ULL;
+};
 
-    int range = max - min + 1;
+// Draws the keys in the same order the runtime initialisation used to, so hashes stay the same
+static constexpr ZobristKeys GenerateZobrist() {
+    ZobristKeys keys;
+    U64 state = initialSeed;
 
-    return min + (RandomU64() % range);
-}
-
-void InitZobrist() {
     // init piece square keys 
     for (int i = White; i <= Black; i++) {
         for (int j = Pawn; j <= King; j++) {
             for (int k = a1; k <= h8; k++) {
-                zKeys[i][j][k] = RandomU64();
+                keys.pieces[i][j][k] = XorShift(state);
             }
         } 
     }
 
     // init en passant file keys
     for (int i = 0; i < 8; i++) {
-        zEnPassant[i] = RandomU64();
+        keys.enPassant[i] = XorShift(state);
     }
 
     // init castling rights keys
     for (int i = 0; i < 16; i++) {
-        zCastle[i] = RandomU64();
+        keys.castle[i] = XorShift(state);
     }
 
     // init side key
-    zSide = RandomU64();
+    keys.side = XorShift(state);
+
+    keys.finalState = state;
+    return keys;
+}
+
+static constexpr ZobristKeys zobrist = GenerateZobrist();
+
+constexpr MultiArray<U64, 2, 6, 64> zKeys = zobrist.pieces;
+constexpr std::array<U64, 8> zEnPassant = zobrist.enPassant;
+constexpr std::array<U64, 16> zCastle = zobrist.castle;
+constexpr U64 zSide = zobrist.side;
+
+// Continues after the Zobrist keys instead of replaying them, as when they were drawn at startup
+static U64 randomState = zobrist.finalState;
+
+static U64 RandomU64() {
+    return XorShift(randomState);
+}
+
+bool RandomBool() {
+    return (RandomU64() & 1) == 1;
+}
+
+int RandomInt(int min, int max) {
+    if (max < min) {
+        int temp = min;
+        min = max;
+        max = temp;
+    }
+
+    int range = max - min + 1;
+
+    return min + (RandomU64() % range);
 }
 
 U64 GetHashKey(Board &board) {
@@ -111,7 +142,8 @@ int parseSquare(std::string_view str) {
 }
 
 Move parseMove(Board &board, std::string_view str) {
-    MOVEGEN::GenerateMoves<All>(board, true);
+    MoveList moveList;
+    MOVEGEN::GenerateMoves<All>(board, moveList);
 
     int from = parseSquare(str.substr(0, 2));
     int to = parseSquare(str.substr(2, 2));
@@ -152,7 +184,7 @@ Move parseMove(Board &board, std::string_view str) {
             }
         }
     } else {
-        for (Move move : board.moveList) {
+        for (Move move : moveList) {
             if (move.MoveFrom() == from && move.MoveTo() == to) {
                 flag = move.GetFlags();
                 break;
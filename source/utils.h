@@ -6,25 +6,28 @@
 #include "move.h"
 #include "board.h"
 
+#include "../external/multi_array.h"
+
 namespace UTILS {
 
 // Zobrist //
 
+// Keys are generated at compile time in utils.cpp
+
 // 2[colors] * 6[pieces] * 64[squares]
-inline U64 zKeys[2][6][64];
+extern const MultiArray<U64, 2, 6, 64> zKeys;
 
 // There are 8 files
-inline U64 zEnPassant[8];
+extern const std::array<U64, 8> zEnPassant;
 
 // 16 possible castling right variations
-inline U64 zCastle[16];
+extern const std::array<U64, 16> zCastle;
 
-inline U64 zSide;
+extern const U64 zSide;
 
 bool RandomBool();
 int RandomInt(int min, int max);
 
-void InitZobrist();
 U64 GetHashKey(Board &board);
 
 std::vector<std::string> split(std::string_view str, char delim);